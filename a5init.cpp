@@ -18,38 +18,44 @@
  */
 
 #include "a5init.h"
+#include "bereader.h"
 
 #include <boost/format.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
 
 bool A5InitLoader::isSupported(const CodeSegment &code, const uint32 offset, const uint32 size) throw() {
 	// Check whether the name matches
 	if (code.getName() != "%A5Init")
 		return false;
 
-	const byte *memory = _executable.getMemory();
 	const uint32 memorySize = _executable.getMemorySize();
 
+	if (offset >= memorySize)
+		return false;
+
+	BigEndianReader segment(_executable.getMemory() + offset, memorySize - offset);
+
 	// Check whether it only exports one function
-	if (!code.is32BitSegment() && READ_UINT16_BE(memory + offset + 2) != 0x0001)
+	if (!code.is32BitSegment() && segment.getUint16(2) != 0x0001)
 		return false;
-	else if (READ_UINT32_BE(memory + offset + 8) != 0x00000001)
+	else if (segment.getUint32(8) != 0x00000001)
 		return false;
 
 	const uint32 internalOffset = (code.is32BitSegment() ? 46 : 10);
-	const uint32 infoOffset = READ_UINT16_BE(memory + offset + internalOffset) + internalOffset;
+	const uint32 infoOffset = segment.getUint16(internalOffset) + internalOffset;
 
 	// Check whether the information area is still inside the memory dump
-	if (offset + infoOffset + 16 >= memorySize)
-		return false;
+	const A5InitInfo *info = segment.overlay<A5InitInfo>(infoOffset);
 
-	const uint32 dataOffset = READ_UINT32_BE(memory + offset + infoOffset + 8);
-	const uint32 relocationDataOffset = READ_UINT32_BE(memory + offset + infoOffset + 12);
+	if (!info || segment.err())
+		return false;
 
 	// Check whether the compressed data is still in the memory dump
-	if (offset + dataOffset >= memorySize)
+	if (!segment.fits(infoOffset + info->dataOffset, 1))
 		return false;
 	// Check whether the relocation data is still in the memory dump
-	if (offset + relocationDataOffset >= memorySize)
+	if (!segment.fits(infoOffset + info->relocationDataOffset, 1))
 		return false;
 
 	// Looks like it is an %A5Init segment
@@ -58,13 +64,19 @@ bool A5InitLoader::isSupported(const CodeSegment &code, const uint32 offset, con
 
 void A5InitLoader::load(const CodeSegment &code, const uint32 offset, const uint32 size, std::ostream &out) throw(std::exception) {
 	byte *memory = _executable.getMemory();
+	BigEndianReader segment(memory + offset, _executable.getMemorySize() - offset);
 
 	const uint32 internalOffset = (code.is32BitSegment() ? 46 : 10);
-	const uint32 infoOffset = READ_UINT16_BE(memory + offset + internalOffset) + internalOffset;
-	const uint32 dataSize = READ_UINT32_BE(memory + offset + infoOffset + 0);
-	const uint16 needLoadBit = READ_UINT16_BE(memory + offset + infoOffset + 4);
-	const uint32 dataOffset = READ_UINT32_BE(memory + offset + infoOffset + 8);
-	const uint32 relocationDataOffset = READ_UINT32_BE(memory + offset + infoOffset + 12);
+	const uint32 infoOffset = segment.getUint16(internalOffset) + internalOffset;
+	const A5InitInfo *info = segment.overlay<A5InitInfo>(infoOffset);
+
+	if (!info)
+		throw std::runtime_error("%A5Init info data lies outside of the memory dump");
+
+	const uint32 dataSize = info->dataSize;
+	const uint16 needLoadBit = info->needLoad;
+	const uint32 dataOffset = info->dataOffset;
+	const uint32 relocationDataOffset = info->relocationDataOffset;
 
 	// Output various information about the %A5Init segment
 	out << "%A5Init info data:\n"
@@ -80,122 +92,79 @@ void A5InitLoader::load(const CodeSegment &code, const uint32 offset, const uint
 	}
 
 	const Code0Segment &code0 = _executable.getCode0Segment();
-	uint8 *dst = memory + code0.getApplicationGlobalsSize() - dataSize;
+
+	if (dataSize > code0.getApplicationGlobalsSize())
+		throw std::runtime_error("%A5Init data size " + boost::lexical_cast<std::string>(dataSize) + " exceeds the application globals");
+
+	const uint32 dst = code0.getApplicationGlobalsSize() - dataSize;
 
 	// uncompress the world
-	uncompressA5World(dst, memory + offset + infoOffset + dataOffset);
+	segment.seek(infoOffset + dataOffset);
+
+	if (!uncompressA5World(dst, segment) || segment.err())
+		throw std::runtime_error("%A5Init compressed data is invalid");
 
 	// relocate the world
-	relocateWorld(code0.getApplicationGlobalsSize(), dst, memory + offset + infoOffset + relocationDataOffset, out);
+	segment.seek(infoOffset + relocationDataOffset);
+
+	if (!relocateWorld(code0.getApplicationGlobalsSize(), dst, segment, out) || segment.err())
+		throw std::runtime_error("%A5Init relocation data is invalid");
 
 	// Mark segment as initialized
 	WRITE_UINT16_BE(memory + offset + infoOffset + 4, 0);
 }
 
-void A5InitLoader::uncompressA5World(uint8 *dst, const uint8 *src) const throw() {
-	assert(dst != nullptr);
-	assert(src != nullptr);
+bool A5InitLoader::uncompressA5World(uint32 dst, BigEndianReader &src) const throw() {
+	byte *memory = _executable.getMemory();
+	const uint64 memorySize = _executable.getMemorySize();
 
 	while (true) {
 		uint32 loops = 1;
-		uint32 size = *src++;
+		uint32 size = src.readByte();
 		uint32 offset = size;
 
 		size &= 0x0F;
 		if (!size) {
-			size = getRunLength(src, loops);
+			size = RelocationTable::getRunLength(src, loops);
 
 			if (!size)
-				return;
+				return true;
 		} else {
 			size += size;
 		}
 
 		offset &= 0xF0;
 		if (!offset)
-			offset = getRunLength(src, loops);
+			offset = RelocationTable::getRunLength(src, loops);
 		else
 			offset >>= 3;
 
+		if (!loops)
+			return false;
+
 		do {
+			const byte *data = src.readSpan(size);
+
+			if (!data || (uint64)dst + offset + size > memorySize)
+				return false;
+
 			dst += offset;
-			std::memcpy(dst, src, size);
+			std::memcpy(memory + dst, data, size);
 			dst += size;
-			src += size;
 		} while (--loops);
 	}
 }
 
-uint32 A5InitLoader::getRunLength(const uint8 *&src, uint32 &special) const throw() {
-	assert(src != nullptr);
-
-	uint32 rl = *src++;
-
-	if (!(rl & 0x80)) {
-		return rl;
-	} else if (!(rl & 0x40)) {
-		rl &= 0x3F;
-		rl <<= 8;
-		rl |= *src++;
-		return rl;
-	} else if (!(rl & 0x20)) {
-		rl &= 0x1F;
-		rl <<= 8;
-		rl |= *src++;
-		rl <<= 8;
-		rl |= *src++;
-		return rl;
-	} else if (!(rl & 0x10)) {
-		rl = READ_UINT32_BE(src);
-		src += 4;
-		return rl;
-	} else {
-		rl = getRunLength(src, special);
-		special = getRunLength(src, special);
-		return rl;
-	}
-}
-
-void A5InitLoader::relocateWorld(const uint32 a5, uint8 *dst, const uint8 *src, std::ostream &out) const throw() {
-	assert(dst != nullptr);
-	assert(src != nullptr);
-
-	uint32 dummy = 0;
+bool A5InitLoader::relocateWorld(const uint32 a5, uint32 dst, BigEndianReader &src, std::ostream &out) const throw() {
+	RelocationTable relocations(RelocationTable::kTypeA5World);
 
-	while (true) {
-		uint32 loops = 1;
-		uint32 offset = *src++;
-
-		if (offset) {
-			if (offset & 0x80) {
-				offset &= 0x7F;
-				offset <<= 8;
-				offset |= *src++;
-			}
-		} else {
-			offset = *src++;
-			if (!offset)
-				return;
-
-			if (offset & 0x80) {
-				offset <<= 8;
-				offset |= *src++;
-				offset <<= 8;
-				offset |= *src++;
-				offset <<= 8;
-				offset |= *src++;
-			} else {
-				loops = getRunLength(src, dummy);
-			}
-		}
+	if (relocations.decode(RelocationTable::kEncodingA5World, src, dst, _executable.getMemorySize() - dst) != RelocationTable::kStatusOK)
+		return false;
 
-		offset += offset;
+	BOOST_FOREACH(uint32 offset, relocations.getOffsets())
+		out << boost::format("Relocation at 0x%1$08X\n") % offset;
 
-		do {
-			dst += offset;
-			out << boost::format("Relocation at 0x%1$08X\n") % (dst - _executable.getMemory());
-			WRITE_UINT32_BE(dst, READ_UINT32_BE(dst) + a5);
-		} while (--loops);
-	}
+	relocations.apply(_executable.getMemory(), a5, _executable.getThreadCount());
+	_executable.addRelocationTable(relocations);
+	return true;
 }
-
@@ -22,6 +22,9 @@
 
 #include "staticdata.h"
 
+// Forward from bereader.h
+class BigEndianReader;
+
 /**
  * A loader for the %A5Init segment.
  */
@@ -61,29 +64,22 @@ private:
 	/**
 	 * Do the real world uncompression.
 	 *
-	 * @param dst Where to store the data.
-	 * @param src Where the compressed data lies.
-	 */
-	void uncompressA5World(uint8 *dst, const uint8 *src) const throw();
-
-	/**
-	 * Get the run length from the given address.
-	 *
-	 * @param src Where to read from.
-	 * @param special Special repeat counter.
-	 * @return The decoded run length.
+	 * @param dst Offset into the memory dump where to store the data.
+	 * @param src Reader positioned at the compressed data.
+	 * @return false in case the data does not fit into the memory dump.
 	 */
-	uint32 getRunLength(const uint8 *&src, uint32 &special) const throw();
+	bool uncompressA5World(uint32 dst, BigEndianReader &src) const throw();
 
 	/**
 	 * Relocate the world data.
 	 *
 	 * @param a5 A5 base offset.
-	 * @param dst Destination start.
-	 * @param src Where the relocation data lies.
+	 * @param dst Offset of the world in the memory dump.
+	 * @param src Reader positioned at the relocation data.
 	 * @param out Where to output misc loading information.
+	 * @return false in case a relocation lies outside of the memory dump.
 	 */
-	void relocateWorld(const uint32 a5, uint8 *dst, const uint8 *src, std::ostream &out) const throw();
+	bool relocateWorld(const uint32 a5, uint32 dst, BigEndianReader &src, std::ostream &out) const throw();
 };
 
 #endif
@@ -0,0 +1,244 @@
+/* bereader.h: Bounds checked big endian reader and header overlays
+ * Copyright (c) 2010-2011 Matthew Hoops (clone2727)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef BEREADER_H
+#define BEREADER_H
+
+#include <cstring>
+#include <boost/static_assert.hpp>
+#include "util.h"
+
+// Big endian integers as stored in a file. They only consist of bytes, so
+// structures built from them have no padding and may be laid over data at
+// any alignment.
+struct BEUint16 {
+	operator uint16() const { return READ_UINT16_BE(bytes); }
+
+	byte bytes[2];
+};
+
+struct BEUint32 {
+	operator uint32() const { return READ_UINT32_BE(bytes); }
+
+	byte bytes[4];
+};
+
+// Reads big endian data from a memory span. Reading past the end yields 0
+// and sets a sticky error flag, thus a whole header can be read before
+// checking err() once.
+class BigEndianReader {
+public:
+	BigEndianReader() { _data = 0; _size = 0; _pos = 0; _err = false; }
+	BigEndianReader(const byte *data, uint32 size) { _data = data; _size = size; _pos = 0; _err = false; }
+
+	const byte *getData() const { return _data; }
+	uint32 size() const { return _size; }
+	uint32 pos() const { return _pos; }
+	uint32 remaining() const { return _size - _pos; }
+	bool eos() const { return _pos >= _size; }
+	bool err() const { return _err; }
+
+	// Whether size bytes at offset lie inside the span
+	bool fits(uint32 offset, uint32 size) const { return offset <= _size && size <= _size - offset; }
+
+	bool seek(uint32 pos) {
+		if (pos > _size) {
+			_err = true;
+			return false;
+		}
+
+		_pos = pos;
+		return true;
+	}
+
+	bool skip(uint32 count) { return seek(count <= remaining() ? _pos + count : _size + 1); }
+
+	byte readByte() {
+		if (_pos >= _size)
+			return fail();
+
+		return _data[_pos++];
+	}
+
+	// The next byte, without consuming it
+	byte peekByte() {
+		if (_pos >= _size)
+			return fail();
+
+		return _data[_pos];
+	}
+
+	uint16 readUint16() {
+		if (!fits(_pos, 2))
+			return fail();
+
+		_pos += 2;
+		return READ_UINT16_BE(_data + _pos - 2);
+	}
+
+	uint32 readUint32() {
+		if (!fits(_pos, 4))
+			return fail();
+
+		_pos += 4;
+		return READ_UINT32_BE(_data + _pos - 4);
+	}
+
+	bool read(byte *buffer, uint32 count) {
+		if (!fits(_pos, count)) {
+			_err = true;
+			return false;
+		}
+
+		std::memcpy(buffer, _data + _pos, count);
+		_pos += count;
+		return true;
+	}
+
+	// Consume count bytes and return them in place, 0 in case they do not fit
+	const byte *readSpan(uint32 count) {
+		if (!fits(_pos, count)) {
+			_err = true;
+			return 0;
+		}
+
+		_pos += count;
+		return _data + _pos - count;
+	}
+
+	// Random access reads, which do not move the position
+	byte getByte(uint32 offset) { return fits(offset, 1) ? _data[offset] : fail(); }
+	uint16 getUint16(uint32 offset) { return fits(offset, 2) ? READ_UINT16_BE(_data + offset) : fail(); }
+	uint32 getUint32(uint32 offset) { return fits(offset, 4) ? READ_UINT32_BE(_data + offset) : fail(); }
+
+	// Lay a header structure over the data at the given offset, 0 in case it
+	// does not fit
+	template<class T>
+	const T *overlay(uint32 offset) {
+		if (!fits(offset, sizeof(T))) {
+			_err = true;
+			return 0;
+		}
+
+		return reinterpret_cast<const T *>(_data + offset);
+	}
+
+	// The header at the current position, which is then skipped
+	template<class T>
+	const T *readOverlay() {
+		const T *header = overlay<T>(_pos);
+
+		if (header)
+			_pos += sizeof(T);
+
+		return header;
+	}
+
+private:
+	byte fail() {
+		_err = true;
+		return 0;
+	}
+
+	const byte *_data;
+	uint32 _size;
+	uint32 _pos;
+	bool _err;
+};
+
+// Resource fork header
+struct ResourceForkHeader {
+	BEUint32 dataOffset;
+	BEUint32 mapOffset;
+	BEUint32 dataLength;
+	BEUint32 mapLength;
+};
+
+// Resource map header, followed by the type list
+struct ResourceMapHeader {
+	byte reserved[16];      // Copy of the fork header
+	BEUint32 nextMap;
+	BEUint16 fileRef;
+	BEUint16 attributes;
+	BEUint16 typeListOffset;
+	BEUint16 nameListOffset;
+	BEUint16 typeCount;     // Number of types minus one
+};
+
+struct ResourceTypeEntry {
+	BEUint32 tag;
+	BEUint16 count;         // Number of resources minus one
+	BEUint16 refListOffset; // Relative to the type list
+};
+
+struct ResourceRefEntry {
+	BEUint16 id;
+	BEUint16 nameOffset;    // Relative to the name list, 0xffff for none
+	BEUint32 attributesAndOffset; // Attributes in the high byte
+	BEUint32 handle;
+};
+
+// CODE 0 header, followed by the jump table
+struct Code0Header {
+	BEUint32 sizeAboveA5;
+	BEUint32 applicationGlobalsSize;
+	BEUint32 jumpTableSize;
+	BEUint32 jumpTableOffset;
+};
+
+// Header of a regular (near model) CODE segment
+struct CodeHeader {
+	BEUint16 jumpTableOffset;
+	BEUint16 jumpTableEntries;
+};
+
+// Header of a 32 bit (far model) CODE segment
+struct Code32Header {
+	BEUint16 marker;        // 0xFFFF
+	BEUint16 reserved;      // 0x0000
+	BEUint32 nearEntryOffset;
+	BEUint32 nearEntryCount;
+	BEUint32 farEntryOffset;
+	BEUint32 farEntryCount;
+	BEUint32 a5RelocationDataOffset;
+	BEUint32 a5Address;     // A5 the segment was linked against
+	BEUint32 segmentRelocationDataOffset;
+	BEUint32 segmentAddress; // Address the segment was linked against
+	BEUint32 reserved2;
+};
+
+// Information block of an %A5Init segment
+struct A5InitInfo {
+	BEUint32 dataSize;
+	BEUint16 needLoad;
+	BEUint16 reserved;
+	BEUint32 dataOffset;    // Relative to the information block
+	BEUint32 relocationDataOffset;
+};
+
+BOOST_STATIC_ASSERT(sizeof(ResourceForkHeader) == 16);
+BOOST_STATIC_ASSERT(sizeof(ResourceMapHeader) == 30);
+BOOST_STATIC_ASSERT(sizeof(ResourceTypeEntry) == 8);
+BOOST_STATIC_ASSERT(sizeof(ResourceRefEntry) == 12);
+BOOST_STATIC_ASSERT(sizeof(Code0Header) == 16);
+BOOST_STATIC_ASSERT(sizeof(CodeHeader) == 4);
+BOOST_STATIC_ASSERT(sizeof(Code32Header) == 40);
+BOOST_STATIC_ASSERT(sizeof(A5InitInfo) == 16);
+
+#endif
@@ -0,0 +1,247 @@
+/* binhex.cpp: BinHex 4.0 decoder
+ * Copyright (c) 2010-2011 Matthew Hoops (clone2727)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "binhex.h"
+
+// Maps the BinHex alphabet to 6 bit values, 0xFE marks whitespace and 0xFD
+// the ':' ending the encoded data
+static const byte kDecodeTable[256] = {
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE, 0xFE, 0xFF, 0xFF, 0xFE, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFE, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0xFF, 0xFF,
+	0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13, 0xFF, 0x14, 0x15, 0xFD, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0xFF,
+	0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x2B, 0xFF, 0x2C, 0x2D, 0x2E, 0x2F, 0xFF, 0xFF, 0xFF, 0xFF,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0xFF, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0xFF, 0xFF,
+	0x3D, 0x3E, 0x3F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+	0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+#define BINHEX_WHITESPACE 0xFE
+#define BINHEX_END 0xFD
+#define BINHEX_RLE 0x90
+
+// CRC-16/XMODEM (polynomial 0x1021), as used by BinHex and MacBinary II
+static const uint16 kCRCTable[256] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+	0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+	0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+	0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+	0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+	0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+	0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+	0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+	0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+	0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+	0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+	0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+	0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+	0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+	0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+	0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+	0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+	0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+	0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+	0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+	0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+	0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+	0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+	0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+	0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+	0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+	0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+	0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+	0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+	0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+BinHexDecoder::BinHexDecoder() {
+	_state = kStateIdentification;
+	_matched = 0;
+	_bits = 0;
+	_bitCount = 0;
+	_repeat = false;
+	_lastByte = 0;
+	_crc = 0;
+	_storedCRCSize = 0;
+	_headerSize = 0;
+	_remaining = 0;
+	_type = 0;
+	_creator = 0;
+	_dataLength = 0;
+	_resourceLength = 0;
+}
+
+bool BinHexDecoder::decode(const byte *text, uint32 size) {
+	const char *identification = getIdentification();
+	const uint32 identificationLength = strlen(identification);
+
+	for (uint32 i = 0; i < size && _state != kStateDone && _state != kStateError; i++) {
+		switch (_state) {
+		case kStateIdentification:
+			// The identification itself is free of repeated prefixes, so on a
+			// mismatch we only have to check whether it starts over
+			if (text[i] == (byte)identification[_matched])
+				_matched++;
+			else
+				_matched = (text[i] == (byte)identification[0]) ? 1 : 0;
+
+			if (_matched == identificationLength)
+				_state = kStateStart;
+			break;
+		case kStateStart:
+			if (text[i] == ':')
+				_state = kStateHeader;
+			break;
+		default:
+			decodeSymbol(kDecodeTable[text[i]]);
+			break;
+		}
+	}
+
+	return _state != kStateError;
+}
+
+void BinHexDecoder::decodeSymbol(byte symbol) {
+	if (symbol == BINHEX_WHITESPACE)
+		return;
+
+	// The encoded data must not end before the resource fork did
+	if (symbol == BINHEX_END || symbol > 0x3F) {
+		_state = kStateError;
+		return;
+	}
+
+	_bits = (_bits << 6) | symbol;
+	_bitCount += 6;
+
+	if (_bitCount >= 8) {
+		_bitCount -= 8;
+		expandByte((_bits >> _bitCount) & 0xFF);
+	}
+}
+
+void BinHexDecoder::expandByte(byte b) {
+	if (_repeat) {
+		_repeat = false;
+
+		// A count of zero stands for the marker byte itself
+		if (b == 0) {
+			writeByte(BINHEX_RLE);
+			_lastByte = BINHEX_RLE;
+		} else {
+			for (uint32 i = 1; i < b && _state != kStateError; i++)
+				writeByte(_lastByte);
+		}
+	} else if (b == BINHEX_RLE) {
+		_repeat = true;
+	} else {
+		writeByte(b);
+		_lastByte = b;
+	}
+}
+
+void BinHexDecoder::writeByte(byte b) {
+	// Each section is followed by its CRC
+	if (_storedCRCSize > 0 || (_state == kStateHeader && _headerSize && _header.size() == _headerSize) || (_state != kStateHeader && _remaining == 0)) {
+		_storedCRC[_storedCRCSize++] = b;
+
+		if (_storedCRCSize == 2 && !checkCRC())
+			_state = kStateError;
+
+		return;
+	}
+
+	_crc = (_crc << 8) ^ kCRCTable[(_crc >> 8) ^ b];
+
+	switch (_state) {
+	case kStateHeader:
+		_header.push_back(b);
+
+		// Name length, name, version, type, creator, flags and fork lengths
+		if (_header.size() == 1) {
+			_headerSize = 1 + b + 1 + 4 + 4 + 2 + 4 + 4;
+
+			if (b == 0 || b > 63)
+				_state = kStateError;
+		}
+		break;
+	case kStateData:
+		_remaining--;
+		break;
+	case kStateResourceFork:
+		_resourceFork.push_back(b);
+		_remaining--;
+		break;
+	default:
+		break;
+	}
+}
+
+bool BinHexDecoder::checkCRC() {
+	if (READ_UINT16_BE(_storedCRC) != _crc)
+		return false;
+
+	_crc = 0;
+	_storedCRCSize = 0;
+
+	switch (_state) {
+	case kStateHeader:
+		parseHeader();
+		_state = kStateData;
+		_remaining = _dataLength;
+		break;
+	case kStateData:
+		_state = kStateResourceFork;
+		_remaining = _resourceLength;
+		// Do not trust the length too much before the data arrives
+		_resourceFork.reserve(std::min<uint32>(_resourceLength, 16 * 1024 * 1024));
+		break;
+	default:
+		_state = kStateDone;
+		break;
+	}
+
+	return true;
+}
+
+void BinHexDecoder::parseHeader() {
+	const byte *header = &_header[0];
+	const byte nameLength = header[0];
+
+	_name.assign((const char *)header + 1, nameLength);
+	header += 1 + nameLength + 1;
+
+	_type = READ_UINT32_BE(header + 0);
+	_creator = READ_UINT32_BE(header + 4);
+	_dataLength = READ_UINT32_BE(header + 10);
+	_resourceLength = READ_UINT32_BE(header + 14);
+}
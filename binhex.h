@@ -0,0 +1,92 @@
+/* binhex.h: BinHex 4.0 decoder
+ * Copyright (c) 2010-2011 Matthew Hoops (clone2727)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef BINHEX_H
+#define BINHEX_H
+
+#include <string>
+#include <vector>
+#include "util.h"
+
+// Decodes BinHex 4.0 text in a single pass. The text is fed in chunks of
+// any size; the 6 bit decoding, run length expansion and CRC checks all
+// happen while the chunks arrive. Only the resource fork is kept.
+class BinHexDecoder {
+public:
+	BinHexDecoder();
+
+	// The line every BinHex 4.0 file starts with, possibly after some text
+	static const char *getIdentification() { return "(This file must be converted with BinHex"; }
+
+	// Decode the next chunk of text, returns false once the text turned out
+	// to be malformed or a CRC did not match
+	bool decode(const byte *text, uint32 size);
+
+	// Whether the resource fork has been completely decoded
+	bool isFinished() const { return _state == kStateDone; }
+
+	const std::string &getName() const { return _name; }
+	uint32 getType() const { return _type; }
+	uint32 getCreator() const { return _creator; }
+	std::vector<byte> &getResourceFork() { return _resourceFork; }
+
+private:
+	enum State {
+		kStateIdentification, // Looking for the identification line
+		kStateStart,          // Looking for the ':' starting the encoded data
+		kStateHeader,
+		kStateData,
+		kStateResourceFork,
+		kStateDone,
+		kStateError
+	};
+
+	void decodeSymbol(byte symbol);
+	void expandByte(byte b);
+	void writeByte(byte b);
+	// Check the CRC of a section once both CRC bytes were read
+	bool checkCRC();
+	void parseHeader();
+
+	State _state;
+	uint32 _matched;   // Matched characters of the identification line
+
+	uint32 _bits;      // Pending bits of the 6 bit decoding
+	uint32 _bitCount;
+
+	bool _repeat;      // Whether the last byte was the run length marker
+	byte _lastByte;
+
+	uint16 _crc;
+	byte _storedCRC[2];
+	uint32 _storedCRCSize;
+
+	std::vector<byte> _header;
+	uint32 _headerSize;
+	uint32 _remaining; // Bytes left in the current data or resource fork
+
+	std::string _name;
+	uint32 _type;
+	uint32 _creator;
+	uint32 _dataLength;
+	uint32 _resourceLength;
+	std::vector<byte> _resourceFork;
+};
+
+#endif
@@ -22,8 +22,15 @@
 
 #include "macresfork.h"
 #include "code0.h"
+#include "relocation.h"
 
 #include <string>
+#include <vector>
+
+/**
+ * The resource tag of code segments.
+ */
+const uint32 kCodeTag = 0x434F4445;
 
 /**
  * Any code segement different to CODE 0
@@ -36,10 +43,12 @@ public:
 	 * @param code0 The code 0 segement.
 	 * @param id The id of the code segment.
 	 * @param name The name of the code segment.
-	 * @param pair The resource data to load from.
+	 * @param header The start of the resource data, at least the segment header
+	 *               unless the segment is shorter.
+	 * @param length The size of the resource data.
 	 * @throws std::exception Errors on loading.
 	 */
-	CodeSegment(const Code0Segment &code0, const uint id, const std::string &name, const DataPair &pair) throw(std::exception);
+	CodeSegment(const Code0Segment &code0, const uint id, const std::string &name, const DataView &header, uint32 length) throw(std::exception);
 
 	/**
 	 * Output information about the segment header.
@@ -48,6 +57,11 @@ public:
 	 */
 	void outputHeader(std::ostream &out) const throw();
 
+	/**
+	 * Query the segment id.
+	 */
+	uint getID() const { return _id; }
+
 	/**
 	 * Query the segment name.
 	 */
@@ -58,6 +72,11 @@ public:
 	 */
 	uint32 getSegmentSize() const { return _segmentSize; }
 
+	/**
+	 * Query the jump table entries the segment loads.
+	 */
+	const std::vector<JumpTableBlock> &getJumpTableBlocks() const { return _jumpTableBlocks; }
+
 	/**
 	 * Query whether it is a special 32bit segment.
 	 */
@@ -66,52 +85,66 @@ public:
 	/**
 	 * Write the segment into memory.
 	 *
+	 * The segment data is read from the resource fork straight into the
+	 * memory, the segment itself only keeps its header information.
+	 *
+	 * @param resFork The resource fork the segment was loaded from.
 	 * @param code0 CODE0 Segement containing the jump table.
 	 * @param memory Where to write to.
 	 * @param offset The offset into the memory.
 	 * @param size Size of the memory.
+	 * @param relocations Where to add the decoded relocation tables.
 	 */
-	void loadIntoMemory(Code0Segment &code0, uint8 *memory, uint32 offset, uint32 size) const throw(std::exception);
-private:
+	void loadIntoMemory(ResourceFork &resFork, Code0Segment &code0, uint8 *memory, uint32 offset, uint32 size, std::vector<RelocationTable> &relocations) const throw(std::exception);
 
 	/**
-	 * Initialize a standard segment.
+	 * Copy the segment into memory and relocate it, without touching the
+	 * jump table.
+	 *
+	 * Only the segment's own range of the memory is written, thus several
+	 * segments may be copied at the same time.
 	 *
+	 * @param resFork The resource fork the segment was loaded from.
 	 * @param code0 CODE0 Segement containing the jump table.
 	 * @param memory Where to write to.
 	 * @param offset The offset into the memory.
 	 * @param size Size of the memory.
+	 * @param relocations Where to add the decoded relocation tables.
 	 */
-	void initialize(Code0Segment &code0, uint8 *memory, uint32 offset, uint32 size) const throw(std::exception);
+	void copyIntoMemory(ResourceFork &resFork, const Code0Segment &code0, uint8 *memory, uint32 offset, uint32 size, std::vector<RelocationTable> &relocations) const throw(std::exception);
 
 	/**
-	 * Initialize a 32bit segment.
+	 * Load the jump table entries exported by the segment.
 	 *
 	 * @param code0 CODE0 Segement containing the jump table.
-	 * @param memory Where to write to.
-	 * @param offset The offset into the memory.
-	 * @param size Size of the memory.
+	 * @param offset The offset of the segment in the memory.
+	 * @throws std::exception Entries which are loaded already or reference another segment.
 	 */
-	void initialize32Bit(Code0Segment &code0, uint8 *memory, uint32 offset, uint32 size) const throw(std::exception);
+	void loadJumpTable(Code0Segment &code0, uint32 offset) const throw(std::exception);
+private:
 
 	/**
-	 * Adjust the jump table for a 32bit segment.
+	 * Initialize a 32bit segment.
 	 *
-	 * @param code0 CODE0 Segment containing the jump table.
-	 * @param startOffset Start offset into the jump table.
-	 * @param count How many entries to process.
+	 * @param code0 CODE0 Segement containing the jump table.
+	 * @param memory Where to write to.
 	 * @param offset The offset into the memory.
+	 * @param size Size of the memory.
+	 * @param relocations Where to add the decoded relocation tables.
 	 */
-	void initJumpTableBlock32Bit(Code0Segment &code0, uint32 startOffset, uint32 count, uint32 offset) const throw(std::exception);
+	void initialize32Bit(const Code0Segment &code0, uint8 *memory, uint32 offset, uint32 size, std::vector<RelocationTable> &relocations) const throw(std::exception);
 
 	/**
 	 * Relocate a 32bit segment.
 	 *
-	 * @param start Where the relocation should take place.
-	 * @param src Where the relocation data is located.
-	 * @param offset The offset to add.
+	 * @param memory The memory dump.
+	 * @param offset The offset of the segment in the memory.
+	 * @param relocationDataOffset Offset of the relocation data in the segment.
+	 * @param delta The delta to add.
+	 * @param relocations Where to store the decoded relocations.
+	 * @throws std::exception Relocation data outside of the segment.
 	 */
-	void relocate32Bit(uint8 *memory, const uint8 *src, int32 offset) const;
+	void relocate32Bit(uint8 *memory, uint32 offset, uint32 relocationDataOffset, int32 delta, RelocationTable &relocations) const throw(std::exception);
 
 	/**
 	 * The id of the segment.
@@ -134,9 +167,14 @@ private:
 	uint16 _jumpTableEntries;
 
 	/**
-	 * The segment data.
+	 * The jump table entries the segment loads.
+	 */
+	std::vector<JumpTableBlock> _jumpTableBlocks;
+
+	/**
+	 * The size of the segment data.
 	 */
-	DataPair _data;
+	uint32 _length;
 
 	/**
 	 * The segment size.
@@ -18,22 +18,25 @@
  */
 
 #include "code0.h"
+#include "bereader.h"
 
 #include <boost/lexical_cast.hpp>
 #include <boost/format.hpp>
-#include <boost/foreach.hpp>
 
-Code0Segment::Code0Segment(const DataPair &data) throw(std::exception)
-    : _jumpTable(), _sizeAboveA5(0), _applicationGlobalsSize(0), _jumpTableSize(0), _jumpTableOffset(0) {
+Code0Segment::Code0Segment(const DataView &data) throw(std::exception)
+    : _jumpTable(), _sizeAboveA5(0), _applicationGlobalsSize(0), _jumpTableSize(0), _jumpTableOffset(0), _onlyFirstJumpTableEntryInitialized(false) {
 	// A valid Code 0 segment must have at least the header + 1 jump table entry
 	if (data.length < 24)
 		throw std::runtime_error("CODE 0 segment contains only " + boost::lexical_cast<std::string>(data.length) + " bytes");
 
 	// Read the header
-	_sizeAboveA5 = READ_UINT32_BE(data.data + 0);
-	_applicationGlobalsSize = READ_UINT32_BE(data.data + 4);
-	_jumpTableSize = READ_UINT32_BE(data.data + 8);
-	_jumpTableOffset = READ_UINT32_BE(data.data + 12);
+	BigEndianReader reader(data.data, data.length);
+	const Code0Header *header = reader.readOverlay<Code0Header>();
+
+	_sizeAboveA5 = header->sizeAboveA5;
+	_applicationGlobalsSize = header->applicationGlobalsSize;
+	_jumpTableSize = header->jumpTableSize;
+	_jumpTableOffset = header->jumpTableOffset;
 
 	// Validate the header fields
 	if (_jumpTableSize % 8 != 0)
@@ -46,12 +49,10 @@ Code0Segment::Code0Segment(const DataPair &data) throw(std::exception)
 		throw std::runtime_error("CODE 0 segment has odd size " + boost::lexical_cast<std::string>(getSegmentSize()));
 
 	// Load the jump table
-	_jumpTable.resize(_jumpTableSize / 8);
-	for (uint offset = 0, i = 0; offset < _jumpTableSize; offset += 8, ++i) {
-		JumpTableEntry entry;
-		std::memcpy(entry.rawData, data.data + 16 + offset, 8);
-		_jumpTable[i] = entry;
-	}
+	if (!reader.fits(reader.pos(), _jumpTableSize))
+		throw std::runtime_error("CODE 0 segment jump table of size " + boost::lexical_cast<std::string>(_jumpTableSize) + " exceeds the segment size " + boost::lexical_cast<std::string>(data.length));
+
+	_jumpTable.assign(reader.readSpan(_jumpTableSize), _jumpTableSize / JumpTable::kEntrySize);
 
 	// Check for a uninitialized jump table
 	if (_sizeAboveA5 > _jumpTableSize + _jumpTableOffset) {
@@ -64,12 +65,7 @@ Code0Segment::Code0Segment(const DataPair &data) throw(std::exception)
 			throw std::runtime_error("CODE 0 segment has invalid (uninitialized) jump table size " + boost::lexical_cast<std::string>(_jumpTableSize));
 
 		// Add dummy entries to the jump table
-		_jumpTable.resize(jumpTableSize / 8);
-		for (uint32 i = 1, end = jumpTableSize / 8; i < end; ++i) {
-			JumpTableEntry entry;
-			std::memset(&entry, 0, sizeof(entry));
-			_jumpTable[i] = entry;
-		}
+		_jumpTable.resize(jumpTableSize / JumpTable::kEntrySize);
 	}
 }
 
@@ -86,16 +82,19 @@ void Code0Segment::outputJumptable(std::ostream &out) const throw() {
 	out << "Jump table information\n"
 	    << "======================\n"
 	    << "Partly initialized jump table: " << (_onlyFirstJumpTableEntryInitialized ? "true" : "false") << "\n"
-	    << "Entries: " << _jumpTable.size() << "\n";
+	    << "Entries: " << _jumpTable.getEntryCount() << "\n";
 
-	for (uint i = 0, offset = 16, size = _jumpTable.size(); i < size; ++i, offset += 8) {
-		const JumpTableEntry &entry = _jumpTable[i];
+	// Stop as soon as all real entries are written, partly initialized
+	// tables consist almost only of dummies
+	uint32 remaining = _jumpTable.getEntryCount() - _jumpTable.getDummyCount();
 
-		if (entry.isDummy())
+	for (uint32 i = 0; remaining > 0; ++i) {
+		if (_jumpTable.isDummy(i))
 			continue;
 
-		out << "Entry " << i << ": Raw: " << boost::format("%1$02X%2$02X%3$02X%4$02X%5$02X%6$02X%7$02X%8$02X") % (uint)entry.rawData[0] % (uint)entry.rawData[1] %
-		    (uint)entry.rawData[2] % (uint)entry.rawData[3] % (uint)entry.rawData[4] % (uint)entry.rawData[5] % (uint)entry.rawData[6] % (uint)entry.rawData[7] << "\n";
+		const byte *entry = _jumpTable.getRawEntry(i);
+		out << "Entry " << i << ": Raw: " << boost::format("%1$08X%2$08X") % READ_UINT32_BE(entry) % READ_UINT32_BE(entry + 4) << "\n";
+		--remaining;
 	}
 
 	out << "\n" << std::flush;
@@ -112,9 +111,7 @@ void Code0Segment::loadIntoMemory(uint8 *memory, uint32 size) const throw(std::e
 	memory += _applicationGlobalsSize + _jumpTableOffset;
 
 	// Write the jump table to the memory dump
-	BOOST_FOREACH(const JumpTableEntry &entry, _jumpTable) {
-		std::memcpy(memory, entry.rawData, 8);
-		memory += 8;
-	}
+	if (_jumpTable.getEntryCount())
+		std::memcpy(memory, _jumpTable.getRawData(), getJumpTableSize());
 }
 
@@ -35,10 +35,10 @@ public:
 	/**
 	 * Load a Code 0 segment.
 	 *
-	 * @param pair The resource data to load from.
+	 * @param data The resource data to load from.
 	 * @throws std::exception Errors on loading.
 	 */
-	Code0Segment(const DataPair &pair) throw(std::exception);
+	Code0Segment(const DataView &data) throw(std::exception);
 
 	/**
 	 * Output information about the segment header.
@@ -69,12 +69,12 @@ public:
 	/**
 	 * Query the size of the jump table.
 	 */
-	uint32 getJumpTableSize() const { return _jumpTable.size() * 8; }
+	uint32 getJumpTableSize() const { return _jumpTable.getEntryCount() * JumpTable::kEntrySize; }
 
 	/**
 	 * Query the number of jump table entries.
 	 */
-	uint32 getJumpTableEntryCount() const { return _jumpTable.size(); }
+	uint32 getJumpTableEntryCount() const { return _jumpTable.getEntryCount(); }
 
 	/**
 	 * Query the size of the globals.
@@ -99,11 +99,10 @@ public:
 	}
 
 	/**
-	 * Query a jump table entry.
+	 * Query the jump table.
 	 */
-	JumpTableEntry &getJumpTableEntry(int entry) throw(std::exception) {
-		return _jumpTable.at(entry);
-	}
+	JumpTable &getJumpTable() { return _jumpTable; }
+	const JumpTable &getJumpTable() const { return _jumpTable; }
 
 	/**
 	 * Query whether the jump table is partly uninitialized.
@@ -112,11 +111,6 @@ public:
 		return _onlyFirstJumpTableEntryInitialized;
 	}
 private:
-	/**
-	 * The jump table vector.
-	 */
-	typedef std::vector<JumpTableEntry> JumpTable;
-
 	/**
 	 * The jump table of the segment.
 	 */
@@ -18,23 +18,22 @@
  */
 
 #include "data00.h"
+#include "bereader.h"
 
 #include <boost/lexical_cast.hpp>
 
 Data00Loader::Data00Loader(Executable &exe) throw(std::exception)
-    : StaticDataLoader(exe), _resFork(exe.getResourceFork()), _data00(nullptr) {
+    : StaticDataLoader(exe), _resFork(exe.getResourceFork()), _data00() {
 }
 
 Data00Loader::~Data00Loader() {
-	destroy(_data00);
 }
 
 void Data00Loader::reset() throw(std::exception) {
-	destroy(_data00);
+	_data00.reset();
 }
 
 bool Data00Loader::isSupported(const CodeSegment &code, const uint32 offset, const uint32 size) throw() {
-	const byte *memory = _executable.getMemory();
 	const uint32 memorySize = _executable.getMemorySize();
 
 	// TODO: This detection heuristic is probably all wrong...
@@ -43,25 +42,28 @@ bool Data00Loader::isSupported(const CodeSegment &code, const uint32 offset, con
 	if (memorySize < offset + 0x210)
 		return false;
 
+	BigEndianReader segment(_executable.getMemory() + offset, memorySize - offset);
+	const CodeHeader *header = segment.overlay<CodeHeader>(0);
+
 	// Check whether the offset into the jump table is 0
-	if (READ_UINT16_BE(memory + offset + 0) != 0)
+	if (header->jumpTableOffset != 0)
 		return false;
 
 	// Check whether just one function is exported
-	if (READ_UINT16_BE(memory + offset + 2) != 1)
+	if (header->jumpTableEntries != 1)
 		return false;
 
 	// Check whether a "CODE" tag is at 0xA
-	if (READ_UINT32_BE(memory + offset + 0x0A) != 0x434F4445)
+	if (segment.getUint32(0x0A) != 0x434F4445)
 		return false;
 
 	// Check whether a "DATA" tag is at 0x44
-	if (READ_UINT32_BE(memory + offset + 0x44) != 0x44415441)
+	if (segment.getUint32(0x44) != 0x44415441)
 		return false;
 
 	// Check whether we have an DATA00 resource
-	_data00 = _resFork.getResource(0x44415441, 0x0000);
-	if (_data00 == nullptr)
+	_data00 = _resFork.getSharedResource(0x44415441, 0x0000);
+	if (!_data00)
 		return false;
 
 	return true;
@@ -77,16 +79,21 @@ void Data00Loader::load(const CodeSegment &code, const uint32 offset, const uint
 const byte *Data00Loader::uncompress(const uint32 offset, std::ostream &out) throw(std::exception) {
 	byte * const memory = _executable.getMemory();
 	Code0Segment &code0 = _executable.getCode0Segment();
+	byte * const memoryEnd = memory + _executable.getMemorySize();
 	byte * const a5Base = memory + code0.getApplicationGlobalsSize();
-	const byte *src = _data00->data + 4;
+	BigEndianReader src(_data00->data, _data00->length);
+
+	src.skip(4);
 
 	// Whether data was written to the jump table
 	bool dataWrittenToJumpTable = false;
 
 	for (uint i = 0; i < 3; ++i) {
 		// Read the offset
-		const int32 offset = (int32)READ_UINT32_BE(src);
-		src += 4;
+		const int32 offset = (int32)src.readUint32();
+
+		if (offset < -(int32)code0.getApplicationGlobalsSize() || offset > memoryEnd - a5Base)
+			throw std::runtime_error("DATA00 Loader: Invalid offset " + boost::lexical_cast<std::string>(offset) + " encountered");
 
 		uint8 *dst = a5Base + offset;
 
@@ -97,14 +104,24 @@ const byte *Data00Loader::uncompress(const uint32 offset, std::ostream &out) thr
 		}
 
 		while (true) {
-			uint8 code = *src++;
+			uint8 code = src.readByte();
+
+			if (src.err())
+				throw std::runtime_error("DATA00 Loader: Compressed data is truncated");
+
+			// Number of bytes the code expands to
+			const uint32 count = (code & 0x80) ? (code & 0x7F) + 1 : (code & 0x40) ? (code & 0x3F) + 1 : (code & 0x20) ? (code & 0x1F) + 2 :
+			                     (code & 0x10) ? (code & 0x0F) + 1 : (code >= 1 && code <= 4) ? 8 : 0;
+
+			if (count > (uint32)(memoryEnd - dst))
+				throw std::runtime_error("DATA00 Loader: Data is written outside of the memory dump");
 
 			if (code & 0x80) {
 				code &= 0x7F;
 				code += 1;
 
-				std::memcpy(dst, src, code);
-				src += code;
+				if (!src.read(dst, code))
+					throw std::runtime_error("DATA00 Loader: Compressed data is truncated");
 				dst += code;
 			} else if (code & 0x40) {
 				code &= 0x3F;
@@ -116,7 +133,7 @@ const byte *Data00Loader::uncompress(const uint32 offset, std::ostream &out) thr
 				code &= 0x1F;
 				code += 2;
 
-				const uint8 data = *src++;
+				const uint8 data = src.readByte();
 				std::memset(dst, data, code);
 				dst += code;
 			} else if (code & 0x10) {
@@ -135,35 +152,35 @@ const byte *Data00Loader::uncompress(const uint32 offset, std::ostream &out) thr
 					*dst++ = 0x00;
 					*dst++ = 0xFF;
 					*dst++ = 0xFF;
-					*dst++ = *src++;
-					*dst++ = *src++;
+					*dst++ = src.readByte();
+					*dst++ = src.readByte();
 				} else if (code == 2) {
 					*dst++ = 0x00;
 					*dst++ = 0x00;
 					*dst++ = 0x00;
 					*dst++ = 0x00;
 					*dst++ = 0xFF;
-					*dst++ = *src++;
-					*dst++ = *src++;
-					*dst++ = *src++;
+					*dst++ = src.readByte();
+					*dst++ = src.readByte();
+					*dst++ = src.readByte();
 				} else if (code == 3) {
 					*dst++ = 0xA9;
 					*dst++ = 0xF0;
 					*dst++ = 0x00;
 					*dst++ = 0x00;
-					*dst++ = *src++;
-					*dst++ = *src++;
+					*dst++ = src.readByte();
+					*dst++ = src.readByte();
 					*dst++ = 0x0;
-					*dst++ = *src++;
+					*dst++ = src.readByte();
 				} else if (code == 4) {
 					*dst++ = 0xA9;
 					*dst++ = 0xF0;
 					*dst++ = 0x00;
-					*dst++ = *src++;
-					*dst++ = *src++;
-					*dst++ = *src++;
+					*dst++ = src.readByte();
+					*dst++ = src.readByte();
+					*dst++ = src.readByte();
 					*dst++ = 0x0;
-					*dst++ = *src++;
+					*dst++ = src.readByte();
 				} else {
 					throw std::runtime_error("DATA00 Loader: Invalid code " + boost::lexical_cast<std::string>(int(code)) + " encountered");
 				}
@@ -174,12 +191,11 @@ const byte *Data00Loader::uncompress(const uint32 offset, std::ostream &out) thr
 	// Check whether data was written to the jump table
 	if (dataWrittenToJumpTable) {
 		// Load the data from entry 1 to the last entry into our jump table structure
-		for (uint i = 1, end = code0.getJumpTableEntryCount(); i < end; ++i)
-			std::memcpy(code0.getJumpTableEntry(i).rawData, memory + code0.getJumpTableOffset() + i * 8, 8);
+		code0.getJumpTable().update(1, memory + code0.getJumpTableOffset() + JumpTable::kEntrySize, code0.getJumpTableEntryCount() - 1);
 
 		code0.outputJumptable(out);
 	}
 
-	return src;
+	return src.getData() + src.pos();
 }
 
@@ -22,6 +22,8 @@
 
 #include "staticdata.h"
 
+#include <boost/shared_ptr.hpp>
+
 /**
  * DATA00 segment loader.
  */
@@ -81,9 +83,9 @@ private:
 	ResourceFork &_resFork;
 
 	/**
-	 * The DATA00 segment data.
+	 * The DATA00 segment data, shared with the resource fork's cache.
 	 */
-	DataPair *_data00;
+	boost::shared_ptr<const DataPair> _data00;
 };
 
 #endif
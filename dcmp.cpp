@@ -0,0 +1,934 @@
+/* dcmp.cpp: Decompression of compressed resources
+ * Copyright (c) 2010-2011 Matthew Hoops (clone2727)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <boost/unordered_map.hpp>
+
+#include "dcmp.h"
+
+namespace Dcmp {
+
+#define DCMP_MAGIC 0xA89F6572
+#define DCMP_ATTR_COMPRESSED 0x01
+
+// GreggyBits parameter flags
+#define GREGGY_CUSTOM_TABLE 0x01
+#define GREGGY_TAGGED 0x02
+
+// Decompressed resources are not expected to be larger than this
+static const uint32 kMaxDecompressedSize = 64 * 1024 * 1024;
+
+// Fixed table of frequent 68k words for the codes 0x4B-0xFD of 'dcmp' 0
+static const byte kDcmp0Table[179 * 2] = {
+	0x00, 0x00, 0x4E, 0xBA, 0x00, 0x08, 0x4E, 0x75, 0x00, 0x0C, 0x4E, 0xAD, 0x20, 0x53, 0x2F, 0x0B,
+	0x61, 0x00, 0x00, 0x10, 0x70, 0x00, 0x2F, 0x00, 0x48, 0x6E, 0x20, 0x50, 0x20, 0x6E, 0x2F, 0x2E,
+	0xFF, 0xFC, 0x48, 0xE7, 0x3F, 0x3C, 0x00, 0x04, 0xFF, 0xF8, 0x2F, 0x0C, 0x20, 0x06, 0x4E, 0xED,
+	0x4E, 0x56, 0x20, 0x68, 0x4E, 0x5E, 0x00, 0x01, 0x58, 0x8F, 0x4F, 0xEF, 0x00, 0x02, 0x00, 0x18,
+	0x60, 0x00, 0xFF, 0xFF, 0x50, 0x8F, 0x4E, 0x90, 0x00, 0x06, 0x26, 0x6E, 0x00, 0x14, 0xFF, 0xF4,
+	0x4C, 0xEE, 0x00, 0x0A, 0x00, 0x0E, 0x41, 0xEE, 0x4C, 0xDF, 0x48, 0xC0, 0xFF, 0xF0, 0x2D, 0x40,
+	0x00, 0x12, 0x30, 0x2E, 0x70, 0x01, 0x2F, 0x28, 0x20, 0x54, 0x67, 0x00, 0x00, 0x20, 0x00, 0x1C,
+	0x20, 0x5F, 0x18, 0x00, 0x26, 0x6F, 0x48, 0x78, 0x00, 0x16, 0x41, 0xFA, 0x30, 0x3C, 0x28, 0x40,
+	0x72, 0x00, 0x28, 0x6E, 0x20, 0x0C, 0x66, 0x00, 0x20, 0x6B, 0x2F, 0x07, 0x55, 0x8F, 0x00, 0x28,
+	0xFF, 0xFE, 0xFF, 0xEC, 0x22, 0xD8, 0x20, 0x0B, 0x00, 0x0F, 0x59, 0x8F, 0x2F, 0x3C, 0xFF, 0x00,
+	0x01, 0x18, 0x81, 0xE1, 0x4A, 0x00, 0x4E, 0xB0, 0xFF, 0xE8, 0x48, 0xC7, 0x00, 0x03, 0x00, 0x22,
+	0x00, 0x07, 0x00, 0x1A, 0x67, 0x06, 0x67, 0x08, 0x4E, 0xF9, 0x00, 0x24, 0x20, 0x78, 0x08, 0x00,
+	0x66, 0x04, 0x00, 0x2A, 0x4E, 0xD0, 0x30, 0x28, 0x26, 0x5F, 0x67, 0x04, 0x00, 0x30, 0x43, 0xEE,
+	0x3F, 0x00, 0x20, 0x1F, 0x00, 0x1E, 0xFF, 0xF6, 0x20, 0x2E, 0x42, 0xA7, 0x20, 0x07, 0xFF, 0xFA,
+	0x60, 0x02, 0x3D, 0x40, 0x0C, 0x40, 0x66, 0x06, 0x00, 0x26, 0x2D, 0x48, 0x2F, 0x01, 0x70, 0xFF,
+	0x60, 0x04, 0x18, 0x80, 0x4A, 0x40, 0x00, 0x40, 0x00, 0x2C, 0x2F, 0x08, 0x00, 0x11, 0xFF, 0xE4,
+	0x21, 0x40, 0x26, 0x40, 0xFF, 0xF2, 0x42, 0x6E, 0x4E, 0xB9, 0x3D, 0x7C, 0x00, 0x38, 0x00, 0x0D,
+	0x60, 0x06, 0x42, 0x2E, 0x20, 0x3C, 0x67, 0x0C, 0x2D, 0x68, 0x66, 0x08, 0x4A, 0x2E, 0x4A, 0xAE,
+	0x00, 0x2E, 0x48, 0x40, 0x22, 0x5F, 0x22, 0x00, 0x67, 0x0A, 0x30, 0x07, 0x42, 0x67, 0x00, 0x32,
+	0x20, 0x28, 0x00, 0x09, 0x48, 0x7A, 0x02, 0x00, 0x2F, 0x2B, 0x00, 0x05, 0x22, 0x6E, 0x66, 0x02,
+	0xE5, 0x80, 0x67, 0x0E, 0x66, 0x0A, 0x00, 0x50, 0x3E, 0x00, 0x66, 0x0C, 0x2E, 0x00, 0xFF, 0xEE,
+	0x20, 0x6D, 0x20, 0x40, 0xFF, 0xE0, 0x53, 0x40, 0x60, 0x08, 0x04, 0x80, 0x00, 0x68, 0x0B, 0x7C,
+	0x44, 0x00, 0x41, 0xE8, 0x48, 0x41
+};
+
+// Fixed table of words for the codes 0xD5-0xFD of 'dcmp' 1
+static const byte kDcmp1Table[41 * 2] = {
+	0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x00, 0x03, 0x2E, 0x01, 0x3E, 0x01, 0x01, 0x01, 0x1E, 0x01,
+	0xFF, 0xFF, 0x0E, 0x01, 0x31, 0x00, 0x11, 0x12, 0x01, 0x07, 0x33, 0x32, 0x12, 0x39, 0xED, 0x10,
+	0x01, 0x27, 0x23, 0x22, 0x01, 0x37, 0x07, 0x06, 0x01, 0x17, 0x01, 0x23, 0x00, 0xFF, 0x00, 0x2F,
+	0x07, 0x0E, 0xFD, 0x3C, 0x01, 0x35, 0x01, 0x15, 0x01, 0x02, 0x00, 0x07, 0x00, 0x3E, 0x05, 0xD5,
+	0x02, 0x01, 0x06, 0x07, 0x07, 0x08, 0x30, 0x01, 0x01, 0x33, 0x00, 0x10, 0x17, 0x16, 0x37, 0x3E,
+	0x36, 0x37
+};
+
+// Default table of frequent 68k words of 'dcmp' 2, used by resources which
+// do not bring their own table
+static const byte kDcmp2Table[256 * 2] = {
+	0x00, 0x00, 0x00, 0x08, 0x4E, 0xBA, 0x20, 0x6E, 0x4E, 0x75, 0x00, 0x0C, 0x00, 0x04, 0x70, 0x00,
+	0x00, 0x10, 0x00, 0x02, 0x48, 0x6E, 0xFF, 0xFC, 0x60, 0x00, 0x00, 0x01, 0x48, 0xE7, 0x2F, 0x2E,
+	0x4E, 0x56, 0x00, 0x06, 0x4E, 0x5E, 0x2F, 0x00, 0x61, 0x00, 0xFF, 0xF8, 0x2F, 0x0B, 0xFF, 0xFF,
+	0x00, 0x14, 0x00, 0x0A, 0x00, 0x18, 0x20, 0x5F, 0x00, 0x0E, 0x20, 0x50, 0x3F, 0x3C, 0xFF, 0xF4,
+	0x4C, 0xEE, 0x30, 0x2E, 0x67, 0x00, 0x4C, 0xDF, 0x26, 0x6E, 0x00, 0x12, 0x00, 0x1C, 0x42, 0x67,
+	0xFF, 0xF0, 0x30, 0x3C, 0x2F, 0x0C, 0x00, 0x03, 0x4E, 0xD0, 0x00, 0x20, 0x70, 0x01, 0x00, 0x16,
+	0x2D, 0x40, 0x48, 0xC0, 0x20, 0x78, 0x72, 0x00, 0x58, 0x8F, 0x66, 0x00, 0x4F, 0xEF, 0x42, 0xA7,
+	0x67, 0x06, 0xFF, 0xFA, 0x55, 0x8F, 0x28, 0x6E, 0x3F, 0x00, 0xFF, 0xFE, 0x2F, 0x3C, 0x67, 0x04,
+	0x59, 0x8F, 0x20, 0x6B, 0x00, 0x24, 0x20, 0x1F, 0x41, 0xFA, 0x81, 0xE1, 0x66, 0x04, 0x67, 0x08,
+	0x00, 0x1A, 0x4E, 0xB9, 0x50, 0x8F, 0x20, 0x2E, 0x00, 0x07, 0x4E, 0xB0, 0xFF, 0xF2, 0x3D, 0x40,
+	0x00, 0x1E, 0x20, 0x68, 0x66, 0x06, 0xFF, 0xF6, 0x4E, 0xF9, 0x08, 0x00, 0x0C, 0x40, 0x3D, 0x7C,
+	0xFF, 0xEC, 0x00, 0x05, 0x20, 0x3C, 0xFF, 0xE8, 0xDE, 0xFC, 0x4A, 0x2E, 0x00, 0x30, 0x00, 0x28,
+	0x2F, 0x08, 0x20, 0x0B, 0x60, 0x02, 0x42, 0x6E, 0x2D, 0x48, 0x20, 0x53, 0x20, 0x40, 0x18, 0x00,
+	0x60, 0x04, 0x41, 0xEE, 0x2F, 0x28, 0x2F, 0x01, 0x67, 0x0A, 0x48, 0x40, 0x20, 0x07, 0x66, 0x08,
+	0x01, 0x18, 0x2F, 0x07, 0x30, 0x28, 0x3F, 0x2E, 0x30, 0x2B, 0x22, 0x6E, 0x2F, 0x2B, 0x00, 0x2C,
+	0x67, 0x0C, 0x22, 0x5F, 0x60, 0x06, 0x00, 0xFF, 0x30, 0x07, 0xFF, 0xEE, 0x53, 0x40, 0x00, 0x40,
+	0xFF, 0xE4, 0x4A, 0x40, 0x66, 0x0A, 0x00, 0x0F, 0x4E, 0xAD, 0x70, 0xFF, 0x22, 0xD8, 0x48, 0x6B,
+	0x00, 0x22, 0x20, 0x4B, 0x67, 0x0E, 0x4A, 0xAE, 0x4E, 0x90, 0xFF, 0xE0, 0xFF, 0xC0, 0x00, 0x2A,
+	0x27, 0x40, 0x67, 0x02, 0x51, 0xC8, 0x02, 0xB6, 0x48, 0x7A, 0x22, 0x78, 0xB0, 0x6E, 0xFF, 0xE6,
+	0x00, 0x09, 0x32, 0x2E, 0x3E, 0x00, 0x48, 0x41, 0xFF, 0xEA, 0x43, 0xEE, 0x4E, 0x71, 0x74, 0x00,
+	0x2F, 0x2C, 0x20, 0x6C, 0x00, 0x3C, 0x00, 0x26, 0x00, 0x50, 0x18, 0x80, 0x30, 0x1F, 0x22, 0x00,
+	0x66, 0x0C, 0xFF, 0xDA, 0x00, 0x38, 0x66, 0x02, 0x30, 0x2C, 0x20, 0x0C, 0x2D, 0x6E, 0x42, 0x40,
+	0xFF, 0xE2, 0xA9, 0xF0, 0xFF, 0x00, 0x37, 0x7C, 0xE5, 0x80, 0xFF, 0xDC, 0x48, 0x68, 0x59, 0x4F,
+	0x00, 0x34, 0x3E, 0x1F, 0x60, 0x08, 0x2F, 0x06, 0xFF, 0xDE, 0x60, 0x0A, 0x70, 0x02, 0x00, 0x32,
+	0xFF, 0xCC, 0x00, 0x80, 0x22, 0x51, 0x10, 0x1F, 0x31, 0x7C, 0xA0, 0x29, 0xFF, 0xD8, 0x52, 0x40,
+	0x01, 0x00, 0x67, 0x10, 0xA0, 0x23, 0xFF, 0xCE, 0xFF, 0xD4, 0x20, 0x06, 0x48, 0x78, 0x00, 0x2E,
+	0x50, 0x4F, 0x43, 0xFA, 0x67, 0x12, 0x76, 0x00, 0x41, 0xE8, 0x4A, 0x6E, 0x20, 0xD9, 0x00, 0x5A,
+	0x7F, 0xFF, 0x51, 0xCA, 0x00, 0x5C, 0x2E, 0x00, 0x02, 0x40, 0x48, 0xC7, 0x67, 0x14, 0x0C, 0x80,
+	0x2E, 0x9F, 0xFF, 0xD6, 0x80, 0x00, 0x10, 0x00, 0x48, 0x42, 0x4A, 0x6B, 0xFF, 0xD2, 0x00, 0x48,
+	0x4A, 0x47, 0x4E, 0xD1, 0x20, 0x6F, 0x00, 0x41, 0x60, 0x0C, 0x2A, 0x78, 0x42, 0x2E, 0x32, 0x00,
+	0x65, 0x74, 0x67, 0x16, 0x00, 0x44, 0x48, 0x6D, 0x20, 0x08, 0x48, 0x6C, 0x0B, 0x7C, 0x26, 0x40,
+	0x04, 0x00, 0x00, 0x68, 0x20, 0x6D, 0x00, 0x0D, 0x2A, 0x40, 0x00, 0x0B, 0x00, 0x3E, 0x02, 0x20
+};
+
+bool isCompressed(const byte *data, uint32 size) {
+	return size >= kHeaderSize && READ_UINT32_BE(data) == DCMP_MAGIC && READ_UINT16_BE(data + 4) == kHeaderSize;
+}
+
+bool readHeader(const byte *data, uint32 size, Header &header) {
+	if (!isCompressed(data, size) || !(data[7] & DCMP_ATTR_COMPRESSED))
+		return false;
+
+	header.version = data[6];
+	header.decompressedSize = READ_UINT32_BE(data + 8);
+
+	if (header.version == 8) {
+		// Followed by the working and expansion buffer sizes
+		header.id = (int16)READ_UINT16_BE(data + 14);
+		std::memset(header.parameters, 0, sizeof(header.parameters));
+	} else if (header.version == 9) {
+		header.id = (int16)READ_UINT16_BE(data + 12);
+		std::memcpy(header.parameters, data + 14, sizeof(header.parameters));
+	} else {
+		return false;
+	}
+
+	return true;
+}
+
+// Bounds checked reading of compressed data. Reads past the end return
+// zeros and flag the stream as broken, so the decoders only have to check
+// once per code.
+class Input {
+public:
+	Input(const byte *data, uint32 size) : _pos(data), _end(data + size), _error(false) {}
+
+	bool error() const { return _error; }
+	uint32 left() const { return _end - _pos; }
+
+	byte readByte() {
+		if (_pos == _end) {
+			_error = true;
+			return 0;
+		}
+
+		return *_pos++;
+	}
+
+	const byte *readBytes(uint32 size) {
+		if (size > left()) {
+			_error = true;
+			return 0;
+		}
+
+		const byte *data = _pos;
+		_pos += size;
+		return data;
+	}
+
+	// Signed integer of 1, 2 or 5 bytes as used by DonnBits
+	int32 readVarInt() {
+		byte head = readByte();
+
+		if (head == 0xFF) {
+			const byte *data = readBytes(4);
+			return data ? (int32)READ_UINT32_BE(data) : 0;
+		}
+
+		if (head >= 0x80)
+			return (int16)((((head - 0xC0) & 0xFF) << 8) | readByte());
+
+		return head;
+	}
+
+private:
+	const byte *_pos;
+	const byte *_end;
+	bool _error;
+};
+
+// Bounds checked writing of decompressed data
+class Output {
+public:
+	Output(byte *data, uint32 size) : _pos(data), _end(data + size) {}
+
+	bool isFull() const { return _pos == _end; }
+	// The whole output is always stored
+	bool isTruncated() const { return false; }
+	uint32 left() const { return _end - _pos; }
+	const byte *pos() const { return _pos; }
+
+	bool write(const byte *data, uint32 size) {
+		if (!data || size > left())
+			return false;
+
+		std::memcpy(_pos, data, size);
+		_pos += size;
+		return true;
+	}
+
+	bool writeUint16(uint16 value) {
+		if (left() < 2)
+			return false;
+
+		WRITE_UINT16_BE(_pos, value);
+		_pos += 2;
+		return true;
+	}
+
+	bool writeUint32(uint32 value) {
+		if (left() < 4)
+			return false;
+
+		WRITE_UINT32_BE(_pos, value);
+		_pos += 4;
+		return true;
+	}
+
+	bool fill(const byte *pattern, uint32 patternSize, uint32 count) {
+		if (count > left() / patternSize)
+			return false;
+
+		if (patternSize == 1) {
+			std::memset(_pos, *pattern, count);
+			_pos += count;
+			return true;
+		}
+
+		for (uint32 i = 0; i < count; i++, _pos += patternSize)
+			std::memcpy(_pos, pattern, patternSize);
+
+		return true;
+	}
+
+private:
+	byte *_pos;
+	byte *_end;
+};
+
+// Output storing only the first limit bytes of the decompressed data, which
+// allows to decode just the start of a resource. The decoders stop as soon
+// as it is truncated.
+class PrefixOutput {
+public:
+	PrefixOutput(byte *data, uint32 size, uint32 limit) : _data(data), _pos(0), _size(size), _limit(std::min(limit, size)) {}
+
+	bool isFull() const { return _pos == _size; }
+	// Whether the stored part is complete before the end of the output
+	bool isTruncated() const { return _pos >= _limit && _limit < _size; }
+	uint32 left() const { return _size - _pos; }
+	const byte *pos() const { return _data + std::min(_pos, _limit); }
+
+	bool write(const byte *data, uint32 size) {
+		if (!data || size > left())
+			return false;
+
+		store(data, size);
+		return true;
+	}
+
+	bool writeUint16(uint16 value) {
+		if (left() < 2)
+			return false;
+
+		byte data[2];
+		WRITE_UINT16_BE(data, value);
+		store(data, 2);
+		return true;
+	}
+
+	bool writeUint32(uint32 value) {
+		if (left() < 4)
+			return false;
+
+		byte data[4];
+		WRITE_UINT32_BE(data, value);
+		store(data, 4);
+		return true;
+	}
+
+	bool fill(const byte *pattern, uint32 patternSize, uint32 count) {
+		if (count > left() / patternSize)
+			return false;
+
+		if (patternSize == 1) {
+			if (_pos < _limit)
+				std::memset(_data + _pos, *pattern, std::min(count, _limit - _pos));
+			_pos += count;
+			return true;
+		}
+
+		uint32 i = 0;
+		for (; i < count && _pos < _limit; i++)
+			store(pattern, patternSize);
+
+		_pos += (count - i) * patternSize;
+		return true;
+	}
+
+private:
+	void store(const byte *data, uint32 size) {
+		if (_pos + size <= _limit)
+			std::memcpy(_data + _pos, data, size);
+		else if (_pos < _limit)
+			std::memcpy(_data + _pos, data, _limit - _pos);
+
+		_pos += size;
+	}
+
+	byte *_data;
+	uint32 _pos;
+	uint32 _size;
+	uint32 _limit;
+};
+
+// DonnBits refers back to literals by their number. Literals are output
+// unchanged, so they are remembered as ranges of the output.
+class LiteralHistory {
+public:
+	LiteralHistory() { _literals.reserve(256); }
+
+	void add(const byte *data, uint32 size) { _literals.push_back(DataView(data, size)); }
+
+	template<class OutputType>
+	bool copy(uint32 index, OutputType &out) const {
+		if (index >= _literals.size())
+			return false;
+
+		return out.write(_literals[index].data, _literals[index].length);
+	}
+
+private:
+	std::vector<DataView> _literals;
+};
+
+template<class OutputType>
+static bool decompressLiteral(Input &in, OutputType &out, LiteralHistory &history, uint32 size, bool store) {
+	const byte *literal = out.pos();
+
+	if (!out.write(in.readBytes(size), size))
+		return false;
+
+	if (store)
+		history.add(literal, size);
+
+	return true;
+}
+
+template<class OutputType>
+static bool decompressDonnBitsExtended(Input &in, OutputType &out) {
+	byte kind = in.readByte();
+
+	switch (kind) {
+	case 0x00: {
+		// Segment loader jump table entries of the given segment. The first
+		// entry is output without its function offset.
+		const int32 segment = in.readVarInt();
+		byte entry[8];
+
+		WRITE_UINT16_BE(entry + 2, 0x3F3C);
+		WRITE_UINT16_BE(entry + 4, segment);
+		WRITE_UINT16_BE(entry + 6, 0xA9F0);
+
+		if (!out.write(entry + 2, 6))
+			return false;
+
+		const int32 count = in.readVarInt();
+		uint32 functionOffset = in.readVarInt();
+
+		if (count <= 0)
+			return false;
+
+		for (int32 i = 0; i < count; i++) {
+			if (i > 0)
+				functionOffset += in.readVarInt();
+
+			WRITE_UINT16_BE(entry, functionOffset);
+
+			if (!out.write(entry, 8))
+				return false;
+		}
+
+		return true;
+		}
+	case 0x02:
+	case 0x03: {
+		// Repetition of a byte or word
+		const uint32 size = (kind == 0x02) ? 1 : 2;
+		byte pattern[2];
+
+		if (size == 1)
+			pattern[0] = in.readVarInt();
+		else
+			WRITE_UINT16_BE(pattern, in.readVarInt());
+
+		const int32 count = in.readVarInt();
+
+		return count >= 0 && out.fill(pattern, size, count + 1);
+		}
+	case 0x04: {
+		// Words stored as byte sized differences to their predecessor
+		uint32 value = in.readVarInt();
+		const int32 count = in.readVarInt();
+
+		if (count < 0 || !out.writeUint16(value))
+			return false;
+
+		for (int32 i = 0; i < count; i++) {
+			value += (int8)in.readByte();
+
+			if (!out.writeUint16(value))
+				return false;
+		}
+
+		return true;
+		}
+	case 0x06: {
+		// Longs stored as differences to their predecessor
+		uint32 value = in.readVarInt();
+		const int32 count = in.readVarInt();
+
+		if (count < 0 || !out.writeUint32(value))
+			return false;
+
+		for (int32 i = 0; i < count; i++) {
+			value += in.readVarInt();
+
+			if (!out.writeUint32(value))
+				return false;
+		}
+
+		return true;
+		}
+	default:
+		return false;
+	}
+}
+
+template<class OutputType>
+static bool decompress0(Input &in, OutputType &out) {
+	LiteralHistory history;
+
+	while (!in.error() && !out.isTruncated()) {
+		const byte code = in.readByte();
+		bool success = true;
+
+		if (code < 0x20) {
+			// Literal words, 0x10-0x1F are remembered for later reference
+			int32 count = code & 0x0F;
+
+			if (count == 0)
+				count = in.readVarInt();
+
+			success = count > 0 && (uint32)count <= out.left() / 2 && decompressLiteral(in, out, history, count * 2, code >= 0x10);
+		} else if (code == 0x20 || code == 0x21) {
+			success = history.copy(0x28 + (((code - 0x20) << 8) | in.readByte()), out);
+		} else if (code == 0x22) {
+			const byte *index = in.readBytes(2);
+			success = index && history.copy(0x28 + READ_UINT16_BE(index), out);
+		} else if (code < 0x4B) {
+			success = history.copy(code - 0x23, out);
+		} else if (code < 0xFE) {
+			success = out.write(kDcmp0Table + (code - 0x4B) * 2, 2);
+		} else if (code == 0xFE) {
+			success = decompressDonnBitsExtended(in, out);
+		} else {
+			return out.isFull();
+		}
+
+		if (!success)
+			return false;
+	}
+
+	return !in.error() && out.isTruncated();
+}
+
+template<class OutputType>
+static bool decompress1(Input &in, OutputType &out) {
+	LiteralHistory history;
+
+	while (!in.error() && !out.isTruncated()) {
+		const byte code = in.readByte();
+		bool success = true;
+
+		if (code < 0x20) {
+			// Literal bytes, 0x10-0x1F are remembered for later reference
+			success = decompressLiteral(in, out, history, (code & 0x0F) + 1, code >= 0x10);
+		} else if (code < 0xD0) {
+			success = history.copy(code - 0x20, out);
+		} else if (code == 0xD0 || code == 0xD1) {
+			success = decompressLiteral(in, out, history, in.readByte(), code == 0xD1);
+		} else if (code == 0xD2) {
+			success = history.copy(0xB0 + in.readByte(), out);
+		} else if (code >= 0xD5 && code < 0xFE) {
+			success = out.write(kDcmp1Table + (code - 0xD5) * 2, 2);
+		} else if (code == 0xFE) {
+			// The only known extended code repeats a byte
+			byte pattern = 0;
+
+			if (in.readByte() == 0x02) {
+				pattern = in.readByte();
+				const int32 count = in.readVarInt();
+				success = count >= 0 && out.fill(&pattern, 1, count + 1);
+			} else {
+				success = false;
+			}
+		} else if (code == 0xFF) {
+			return out.isFull();
+		} else {
+			// 0xD3 and 0xD4 are not known to be used
+			success = false;
+		}
+
+		if (!success)
+			return false;
+	}
+
+	return !in.error() && out.isTruncated();
+}
+
+template<class OutputType>
+static bool decompress2(const Header &header, Input &in, OutputType &out) {
+	const byte flags = header.parameters[3];
+	byte tableSize;
+	const byte *table;
+
+	if (flags & GREGGY_CUSTOM_TABLE) {
+		tableSize = header.parameters[2];
+		table = in.readBytes((tableSize + 1) * 2);
+
+		if (!table)
+			return false;
+	} else {
+		tableSize = 0xFF;
+		table = kDcmp2Table;
+	}
+
+	if (!(flags & GREGGY_TAGGED)) {
+		// Every byte refers to the table, except an odd trailing one
+		while (out.left() > 1 && !out.isTruncated()) {
+			const byte index = in.readByte();
+
+			if (in.error() || index > tableSize || !out.write(table + index * 2, 2))
+				return false;
+		}
+	} else {
+		// Each tag byte tells for the next 8 words whether they are stored
+		// literally or as a reference into the table
+		while (out.left() > 1 && !out.isTruncated()) {
+			byte tag = in.readByte();
+
+			for (uint32 i = 0; i < 8 && out.left() > 1; i++, tag <<= 1) {
+				const byte *word;
+
+				if (tag & 0x80) {
+					const byte index = in.readByte();
+					word = (index <= tableSize) ? table + index * 2 : 0;
+				} else {
+					word = in.readBytes(2);
+				}
+
+				if (in.error() || !out.write(word, 2))
+					return false;
+			}
+
+			if (in.error())
+				return false;
+		}
+	}
+
+	// An odd sized resource ends with a plain byte
+	if (out.left() == 1 && !out.isTruncated() && !out.write(in.readBytes(1), 1))
+		return false;
+
+	return !in.error();
+}
+
+template<class OutputType>
+static bool decompress(const Header &header, const byte *src, uint32 srcSize, OutputType &out) {
+	Input in(src, srcSize);
+
+	switch (header.id) {
+	case 0:
+		return header.version == 8 && decompress0(in, out);
+	case 1:
+		return header.version == 8 && decompress1(in, out);
+	case 2:
+		return header.version == 9 && decompress2(header, in, out);
+	default:
+		return false;
+	}
+}
+
+bool decompress(const Header &header, const byte *src, uint32 srcSize, byte *dst) {
+	Output out(dst, header.decompressedSize);
+	return decompress(header, src, srcSize, out);
+}
+
+DataPair *decompress(const DataView &data) {
+	Header header;
+
+	if (!readHeader(data.data, data.length, header) || header.decompressedSize > kMaxDecompressedSize)
+		return 0;
+
+	// Decompress right into the buffer which is handed out
+	DataPair *decompressed = new DataPair(new byte[header.decompressedSize], header.decompressedSize);
+
+	if (!decompress(header, data.data + kHeaderSize, data.length - kHeaderSize, decompressed->data)) {
+		delete decompressed;
+		return 0;
+	}
+
+	return decompressed;
+}
+
+bool decompressStart(const DataView &data, byte *dst, uint32 &size, uint32 &decompressedSize) {
+	Header header;
+
+	if (!readHeader(data.data, data.length, header) || header.decompressedSize > kMaxDecompressedSize)
+		return false;
+
+	// Decoding stops as soon as the requested part is complete
+	decompressedSize = header.decompressedSize;
+	size = std::min(size, decompressedSize);
+
+	if (size == decompressedSize)
+		return decompress(header, data.data + kHeaderSize, data.length - kHeaderSize, dst);
+
+	PrefixOutput out(dst, decompressedSize, size);
+	return decompress(header, data.data + kHeaderSize, data.length - kHeaderSize, out);
+}
+
+// Output of the compressors
+class Writer {
+public:
+	Writer(std::vector<byte> &data) : _data(data) {}
+
+	void writeByte(byte b) { _data.push_back(b); }
+	void writeBytes(const byte *data, uint32 size) { _data.insert(_data.end(), data, data + size); }
+
+	void writeUint16(uint16 value) {
+		byte data[2];
+		WRITE_UINT16_BE(data, value);
+		writeBytes(data, 2);
+	}
+
+	void writeUint32(uint32 value) {
+		byte data[4];
+		WRITE_UINT32_BE(data, value);
+		writeBytes(data, 4);
+	}
+
+	void writeVarInt(int32 value) {
+		if (value >= 0 && value < 0x80) {
+			writeByte(value);
+		} else if (value >= -0x4000 && value < 0x3F00) {
+			writeByte(((value >> 8) + 0xC0) & 0xFF);
+			writeByte(value & 0xFF);
+		} else {
+			writeByte(0xFF);
+			writeUint32(value);
+		}
+	}
+
+private:
+	std::vector<byte> &_data;
+};
+
+// Maps words to their position in a table, -1 for words not in it
+static void buildWordIndex(const byte *table, uint32 count, std::vector<int32> &index) {
+	index.assign(0x10000, -1);
+
+	for (uint32 i = 0; i < count; i++)
+		index[READ_UINT16_BE(table + i * 2)] = i;
+}
+
+// Number of times the word at the given position repeats right away
+static uint32 countWordRepeats(const byte *data, uint32 size, uint32 pos) {
+	uint32 count = 0;
+
+	while (pos + (count + 2) * 2 <= size && !std::memcmp(data + pos, data + pos + (count + 1) * 2, 2))
+		count++;
+
+	return count;
+}
+
+static void compress0(const byte *data, uint32 size, Writer &out) {
+	std::vector<int32> tableIndex;
+	buildWordIndex(kDcmp0Table, 179, tableIndex);
+
+	// Every word not in the fixed table is stored as literal and referred to
+	// by its number afterwards
+	boost::unordered_map<uint16, uint32> literals;
+	const uint32 maxLiterals = 0x28 + 0x10000;
+
+	uint32 pos = 0;
+
+	for (; pos + 2 <= size; pos += 2) {
+		const uint16 word = READ_UINT16_BE(data + pos);
+		const uint32 repeats = countWordRepeats(data, size, pos);
+
+		if (repeats >= 2) {
+			out.writeByte(0xFE);
+			out.writeByte(0x03);
+			out.writeVarInt((int16)word);
+			out.writeVarInt(repeats);
+			pos += repeats * 2;
+		} else if (tableIndex[word] >= 0) {
+			out.writeByte(0x4B + tableIndex[word]);
+		} else if (literals.count(word)) {
+			const uint32 index = literals[word];
+
+			if (index < 0x28) {
+				out.writeByte(0x23 + index);
+			} else if (index < 0x228) {
+				out.writeByte(0x20 + ((index - 0x28) >> 8));
+				out.writeByte((index - 0x28) & 0xFF);
+			} else {
+				out.writeByte(0x22);
+				out.writeUint16(index - 0x28);
+			}
+		} else if (literals.size() < maxLiterals) {
+			const uint32 index = literals.size();
+			literals[word] = index;
+			out.writeByte(0x11);
+			out.writeBytes(data + pos, 2);
+		} else {
+			// Collect words which can not be referred to into one literal
+			uint32 count = 1;
+
+			while (count < 0x3F00 && pos + (count + 1) * 2 <= size && tableIndex[READ_UINT16_BE(data + pos + count * 2)] < 0 && !literals.count(READ_UINT16_BE(data + pos + count * 2)))
+				count++;
+
+			if (count < 0x10) {
+				out.writeByte(count);
+			} else {
+				out.writeByte(0x00);
+				out.writeVarInt(count);
+			}
+
+			out.writeBytes(data + pos, count * 2);
+			pos += (count - 1) * 2;
+		}
+	}
+
+	// A trailing byte is written as a single repetition
+	if (pos < size) {
+		out.writeByte(0xFE);
+		out.writeByte(0x02);
+		out.writeVarInt((int8)data[pos]);
+		out.writeVarInt(0);
+	}
+
+	out.writeByte(0xFF);
+}
+
+static void compress1(const byte *data, uint32 size, Writer &out) {
+	std::vector<int32> tableIndex;
+	buildWordIndex(kDcmp1Table, 41, tableIndex);
+
+	boost::unordered_map<uint16, uint32> literals;
+	const uint32 maxLiterals = 0x1B0;
+
+	uint32 pos = 0;
+
+	for (; pos + 2 <= size; pos += 2) {
+		const uint16 word = READ_UINT16_BE(data + pos);
+		// Only runs of a single byte can be repeated
+		const uint32 repeats = (data[pos] == data[pos + 1]) ? countWordRepeats(data, size, pos) : 0;
+
+		if (repeats >= 2) {
+			out.writeByte(0xFE);
+			out.writeByte(0x02);
+			out.writeByte(data[pos]);
+			out.writeVarInt((repeats + 1) * 2 - 1);
+			pos += repeats * 2;
+		} else if (tableIndex[word] >= 0) {
+			out.writeByte(0xD5 + tableIndex[word]);
+		} else if (literals.count(word)) {
+			const uint32 index = literals[word];
+
+			if (index < 0xB0) {
+				out.writeByte(0x20 + index);
+			} else {
+				out.writeByte(0xD2);
+				out.writeByte(index - 0xB0);
+			}
+		} else if (literals.size() < maxLiterals) {
+			const uint32 index = literals.size();
+			literals[word] = index;
+			out.writeByte(0x11);
+			out.writeBytes(data + pos, 2);
+		} else {
+			// Collect words which can not be referred to into one literal
+			uint32 count = 1;
+
+			while (count < 0x7F && pos + (count + 1) * 2 <= size && tableIndex[READ_UINT16_BE(data + pos + count * 2)] < 0 && !literals.count(READ_UINT16_BE(data + pos + count * 2)))
+				count++;
+
+			if (count <= 8) {
+				out.writeByte(count * 2 - 1);
+			} else {
+				out.writeByte(0xD0);
+				out.writeByte(count * 2);
+			}
+
+			out.writeBytes(data + pos, count * 2);
+			pos += (count - 1) * 2;
+		}
+	}
+
+	if (pos < size) {
+		out.writeByte(0x00);
+		out.writeByte(data[pos]);
+	}
+
+	out.writeByte(0xFF);
+}
+
+static bool compareWordCounts(const std::pair<uint32, uint16> &a, const std::pair<uint32, uint16> &b) {
+	return a.first != b.first ? a.first > b.first : a.second < b.second;
+}
+
+static void compress2(const byte *data, uint32 size, Writer &out, byte *parameters, bool defaultTable) {
+	std::vector<int32> tableIndex(0x10000, -1);
+
+	WRITE_UINT16_BE(parameters, 0);
+
+	if (defaultTable) {
+		for (uint32 i = 256; i-- > 0; )
+			tableIndex[READ_UINT16_BE(kDcmp2Table + i * 2)] = i;
+
+		parameters[2] = 0;
+		parameters[3] = GREGGY_TAGGED;
+	} else {
+		// Build a custom table of the most frequent words
+		std::vector<uint32> counts(0x10000, 0);
+
+		for (uint32 pos = 0; pos + 2 <= size; pos += 2)
+			counts[READ_UINT16_BE(data + pos)]++;
+
+		std::vector<std::pair<uint32, uint16> > words;
+
+		for (uint32 i = 0; i < counts.size(); i++)
+			if (counts[i])
+				words.push_back(std::make_pair(counts[i], i));
+
+		std::sort(words.begin(), words.end(), compareWordCounts);
+		words.resize(std::max<uint32>(std::min<uint32>(words.size(), 256), 1));
+
+		for (uint32 i = 0; i < words.size(); i++) {
+			tableIndex[words[i].second] = i;
+			out.writeUint16(words[i].second);
+		}
+
+		parameters[2] = words.size() - 1;
+		parameters[3] = GREGGY_CUSTOM_TABLE | GREGGY_TAGGED;
+	}
+
+	uint32 pos = 0;
+
+	while (pos + 2 <= size) {
+		std::vector<byte> group;
+		byte tag = 0;
+
+		for (uint32 i = 0; i < 8 && pos + 2 <= size; i++, pos += 2) {
+			const int32 index = tableIndex[READ_UINT16_BE(data + pos)];
+
+			if (index >= 0) {
+				tag |= 0x80 >> i;
+				group.push_back(index);
+			} else {
+				group.insert(group.end(), data + pos, data + pos + 2);
+			}
+		}
+
+		out.writeByte(tag);
+		out.writeBytes(&group[0], group.size());
+	}
+
+	if (pos < size)
+		out.writeByte(data[pos]);
+}
+
+bool compress(int16 id, const byte *data, uint32 size, std::vector<byte> &compressed, bool defaultTable) {
+	if (id < 0 || id > 2)
+		return false;
+
+	compressed.clear();
+	compressed.resize(kHeaderSize, 0);
+
+	byte *header = &compressed[0];
+	WRITE_UINT32_BE(header + 0, DCMP_MAGIC);
+	WRITE_UINT16_BE(header + 4, kHeaderSize);
+	header[6] = (id == 2) ? 9 : 8;
+	header[7] = DCMP_ATTR_COMPRESSED;
+	WRITE_UINT32_BE(header + 8, size);
+
+	Writer out(compressed);
+	byte parameters[4];
+
+	switch (id) {
+	case 0:
+		compress0(data, size, out);
+		break;
+	case 1:
+		compress1(data, size, out);
+		break;
+	default:
+		compress2(data, size, out, parameters, defaultTable);
+		break;
+	}
+
+	// The vector might have moved while compressing
+	header = &compressed[0];
+
+	if (id == 2) {
+		WRITE_UINT16_BE(header + 12, id);
+		std::memcpy(header + 14, parameters, 4);
+	} else {
+		WRITE_UINT16_BE(header + 14, id);
+	}
+
+	return true;
+}
+
+} // End of namespace Dcmp
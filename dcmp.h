@@ -0,0 +1,67 @@
+/* dcmp.h: Decompression of compressed resources
+ * Copyright (c) 2010-2011 Matthew Hoops (clone2727)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef DCMP_H
+#define DCMP_H
+
+#include <vector>
+#include "macresfork.h"
+
+// System 7 resource compression. A compressed resource starts with an
+// extended header naming the 'dcmp' resource able to decompress it; the
+// decompressors for 'dcmp' 0 and 1 (DonnBits) and 2 (GreggyBits) are
+// implemented natively.
+namespace Dcmp {
+
+static const uint32 kHeaderSize = 18;
+
+struct Header {
+	Header() { version = 0; decompressedSize = 0; id = 0; std::memset(parameters, 0, sizeof(parameters)); }
+
+	byte version;           // 8 for 'dcmp' 0 and 1, 9 for 'dcmp' 2
+	uint32 decompressedSize;
+	int16 id;               // Id of the 'dcmp' resource
+	byte parameters[4];     // Decompressor specific, version 9 only
+};
+
+// Whether the data starts with the compressed resource header
+bool isCompressed(const byte *data, uint32 size);
+bool readHeader(const byte *data, uint32 size, Header &header);
+
+// Decompress a whole compressed resource, returns 0 in case the data is
+// malformed or uses an unsupported decompressor
+DataPair *decompress(const DataView &data);
+
+// Decompress only the first size bytes of a whole compressed resource, which
+// spares decoding the rest. Returns the number of bytes stored in size and
+// the size of the whole resource in decompressedSize.
+bool decompressStart(const DataView &data, byte *dst, uint32 &size, uint32 &decompressedSize);
+
+// Decompress the data following the header into exactly
+// header.decompressedSize bytes
+bool decompress(const Header &header, const byte *src, uint32 srcSize, byte *dst);
+
+// Compress data with the given decompressor id, including the header. Used to
+// generate test and benchmark input. 'dcmp' 2 data refers to the default
+// word table instead of storing its own when defaultTable is set.
+bool compress(int16 id, const byte *data, uint32 size, std::vector<byte> &compressed, bool defaultTable = false);
+
+} // End of namespace Dcmp
+
+#endif
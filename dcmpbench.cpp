@@ -0,0 +1,162 @@
+/**
+ * Copyright (c) 2011 Johannes Schickel (LordHoto)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+// Throughput benchmark of the resource decompressors.
+
+#include "dcmp.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+#include <boost/format.hpp>
+
+const uint32 kCodeTag = 0x434F4445;
+
+/**
+ * Query the current time in seconds.
+ */
+static double getTime() {
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+/**
+ * Create m68k like sample data.
+ *
+ * Words are picked from a small skewed vocabulary, so the data compresses
+ * roughly like real code does.
+ *
+ * @param size The size of the data.
+ * @param data Where to store the data.
+ */
+static void createSampleData(uint32 size, std::vector<byte> &data) {
+	std::vector<uint16> vocabulary;
+	uint32 seed = 0x12345678;
+
+	for (uint32 i = 0; i < 256; i++) {
+		seed = seed * 1103515245 + 12345;
+		vocabulary.push_back(seed >> 16);
+	}
+
+	data.resize(size);
+
+	for (uint32 i = 0; i + 1 < size; i += 2) {
+		seed = seed * 1103515245 + 12345;
+		// Squaring the random value makes small indices more likely
+		const uint32 r = (seed >> 16) & 0xFF;
+		WRITE_UINT16_BE(&data[i], vocabulary[(r * r) >> 8]);
+	}
+}
+
+/**
+ * Concatenate all CODE resources of a resource fork.
+ *
+ * @param filename The file to load.
+ * @param data Where to store the data.
+ * @return true on success, false otherwise.
+ */
+static bool loadSampleData(const char *filename, std::vector<byte> &data) {
+	ResourceFork resFork;
+
+	if (!resFork.load(filename))
+		return false;
+
+	ResourceFork::IndexRange range = resFork.getIDRange(kCodeTag);
+
+	for (ResourceFork::IndexIterator it = range.first; it != range.second; ++it) {
+		DataView view = resFork.getResourceView(kCodeTag, it->id);
+
+		if (view.data)
+			data.insert(data.end(), view.data, view.data + view.length);
+	}
+
+	return !data.empty();
+}
+
+int main(int argc, char *argv[]) {
+	uint32 iterations = 20;
+	const char *filename = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "-i") && i + 1 < argc)
+			iterations = std::max<uint32>(std::strtoul(argv[++i], 0, 0), 1);
+		else if (argv[i][0] != '-' && !filename)
+			filename = argv[i];
+		else {
+			std::cerr << "Usage: " << argv[0] << " [-i iterations] [resource fork]\n"
+			             "Uses the CODE resources of the given file or synthetic data." << std::endl;
+			return -1;
+		}
+	}
+
+	std::vector<byte> data;
+
+	if (filename) {
+		if (!loadSampleData(filename, data)) {
+			std::cerr << "Could not load any CODE resources from " << filename << std::endl;
+			return -1;
+		}
+	} else {
+		createSampleData(4 * 1024 * 1024, data);
+	}
+
+	std::vector<byte> decompressed(data.size());
+
+	std::cout << boost::format("Sample size: %u bytes, %u iterations\n") % data.size() % iterations;
+
+	// 'dcmp' 2 is run with a custom and with the default word table
+	for (int16 variant = 0; variant <= 3; variant++) {
+		const int16 id = std::min<int16>(variant, 2);
+		const bool defaultTable = (variant == 3);
+		const std::string name = (boost::format("'dcmp' %d%s") % id % (defaultTable ? " (default table)" : "")).str();
+		std::vector<byte> compressed;
+		Dcmp::Header header;
+
+		if (!Dcmp::compress(id, &data[0], data.size(), compressed, defaultTable) || !Dcmp::readHeader(&compressed[0], compressed.size(), header)) {
+			std::cerr << "Could not compress with " << name << std::endl;
+			return -1;
+		}
+
+		const byte *src = &compressed[0] + Dcmp::kHeaderSize;
+		const uint32 srcSize = compressed.size() - Dcmp::kHeaderSize;
+		bool valid = true;
+
+		const double start = getTime();
+
+		for (uint32 i = 0; i < iterations && valid; i++)
+			valid = Dcmp::decompress(header, src, srcSize, &decompressed[0]);
+
+		const double elapsed = getTime() - start;
+
+		if (!valid || decompressed != data) {
+			std::cerr << name << " did not reproduce the sample data" << std::endl;
+			return -1;
+		}
+
+		std::cout << boost::format("%s: %u bytes compressed (%.1f%%), %.1f MB/s\n")
+		             % name % compressed.size() % (100.0 * compressed.size() / data.size())
+		             % (double(data.size()) * iterations / elapsed / (1024 * 1024));
+	}
+
+	return 0;
+}
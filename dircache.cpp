@@ -0,0 +1,54 @@
+/* dircache.cpp: Cache of directory listings
+ * Copyright (c) 2010-2011 Matthew Hoops (clone2727)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <dirent.h>
+
+#include "dircache.h"
+
+bool DirectoryCache::exists(const std::string &directory, const std::string &name) {
+	boost::lock_guard<boost::mutex> lock(_mutex);
+	const Listing &listing = getListing(directory);
+
+	return listing.find(name) != listing.end();
+}
+
+void DirectoryCache::clear() {
+	boost::lock_guard<boost::mutex> lock(_mutex);
+	_listings.clear();
+}
+
+const DirectoryCache::Listing &DirectoryCache::getListing(const std::string &directory) {
+	boost::unordered_map<std::string, Listing>::iterator it = _listings.find(directory);
+
+	if (it != _listings.end())
+		return it->second;
+
+	// Directories which can not be read are remembered as empty
+	Listing &listing = _listings[directory];
+	DIR *dir = opendir(directory.c_str());
+
+	if (!dir)
+		return listing;
+
+	while (struct dirent *entry = readdir(dir))
+		listing.insert(entry->d_name);
+
+	closedir(dir);
+	return listing;
+}
@@ -0,0 +1,47 @@
+/* dircache.h: Cache of directory listings
+ * Copyright (c) 2010-2011 Matthew Hoops (clone2727)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include <string>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+// Remembers the entries of every directory it is asked about, so looking up
+// many files in the same directory only reads the directory once. Changes
+// made to a directory after it was first listed are not noticed.
+class DirectoryCache {
+public:
+	// Whether the directory contains an entry with the given name
+	bool exists(const std::string &directory, const std::string &name);
+	void clear();
+
+private:
+	typedef boost::unordered_set<std::string> Listing;
+
+	const Listing &getListing(const std::string &directory);
+
+	boost::unordered_map<std::string, Listing> _listings;
+	boost::mutex _mutex;
+};
+
+#endif
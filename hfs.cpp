@@ -0,0 +1,800 @@
+/* hfs.cpp: Read-only HFS and HFS+ volume reader
+ * Copyright (c) 2010-2011 Matthew Hoops (clone2727)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/unordered_map.hpp>
+
+#include "hfs.h"
+
+#define HFS_SIGNATURE 0x4244
+#define HFSPLUS_SIGNATURE 0x482B
+#define HFSX_SIGNATURE 0x4858
+#define HFS_HEADER_OFFSET 1024
+#define DISKCOPY_HEADER_SIZE 84
+
+// Master directory block (HFS)
+#define MDB_SIZE 162
+#define MDB_ALBLKSIZ 20
+#define MDB_ALBLST 28
+#define MDB_VN 36
+#define MDB_EMBEDSIGWORD 124
+#define MDB_EMBEDEXTENT 126
+#define MDB_XTFLSIZE 130
+#define MDB_XTEXTREC 134
+#define MDB_CTFLSIZE 146
+#define MDB_CTEXTREC 150
+
+// Volume header (HFS+)
+#define VH_SIZE 512
+#define VH_BLOCKSIZE 40
+#define VH_EXTENTSFILE 192
+#define VH_CATALOGFILE 272
+
+// Apple partition map
+#define APM_BLOCKSIZE 512
+#define APM_MAPBLKCNT 4
+#define APM_PYPARTSTART 8
+#define APM_PARTYPE 48
+
+// B-trees
+#define BT_NODE_DESCRIPTOR 14
+#define BT_INDEX_NODE 0
+#define BT_LEAF_NODE -1
+#define BT_HEADER_SIZE 56
+#define BT_BIG_KEYS 0x2
+#define BT_VARIABLE_INDEX_KEYS 0x4
+#define BT_MAX_DEPTH 16
+
+// Catalog
+#define EXTENTS_FILE_ID 3
+#define CATALOG_FILE_ID 4
+#define ROOT_FOLDER_ID 2
+#define FOLDER_RECORD 1
+#define FILE_RECORD 2
+#define FOLDER_THREAD_RECORD 3
+
+#define HFS_FILE_RECORD_SIZE 102
+#define HFSPLUS_FILE_RECORD_SIZE 248
+#define HFSPLUS_FORK_DATA_SIZE 80
+
+HFSVolume::HFSVolume() {
+	_fd = -1;
+	_mtime = 0;
+	_hfsPlus = false;
+	_blockBase = 0;
+	_blockSize = 0;
+}
+
+HFSVolume::~HFSVolume() {
+	close();
+}
+
+bool HFSVolume::open(const std::string &filename) {
+	close();
+
+	_fd = ::open(filename.c_str(), O_RDONLY);
+
+	if (_fd == -1)
+		return false;
+
+	struct stat st;
+
+	if (fstat(_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close();
+		return false;
+	}
+
+	_filename = filename;
+	_mtime = st.st_mtime;
+
+	uint64 offset;
+	byte signature[2];
+
+	if (!findVolume(offset) || !readData(offset + HFS_HEADER_OFFSET, signature, 2)) {
+		close();
+		return false;
+	}
+
+	bool loaded = (READ_UINT16_BE(signature) == HFS_SIGNATURE) ? readMasterDirectoryBlock(offset) : readVolumeHeader(offset);
+
+	if (!loaded)
+		close();
+
+	return loaded;
+}
+
+void HFSVolume::close() {
+	if (_fd != -1) {
+		::close(_fd);
+		_fd = -1;
+	}
+
+	_filename.clear();
+	_mtime = 0;
+	_hfsPlus = false;
+	_name.clear();
+	_blockBase = 0;
+	_blockSize = 0;
+	_catalog = BTree();
+	_extentsOverflow = BTree();
+}
+
+bool HFSVolume::readData(uint64 offset, byte *buffer, uint32 size) const {
+	while (size > 0) {
+		ssize_t count = pread(_fd, buffer, size, offset);
+
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			return false;
+
+		buffer += count;
+		offset += count;
+		size -= count;
+	}
+
+	return true;
+}
+
+bool HFSVolume::readExtents(const std::vector<HFSExtent> &extents, uint64 offset, byte *buffer, uint32 size) const {
+	uint64 position = 0;
+
+	for (uint32 i = 0; i < extents.size() && size > 0; i++) {
+		if (offset < position + extents[i].length) {
+			uint32 chunk = std::min<uint64>(size, position + extents[i].length - offset);
+
+			if (!readData(extents[i].offset + (offset - position), buffer, chunk))
+				return false;
+
+			buffer += chunk;
+			offset += chunk;
+			size -= chunk;
+		}
+
+		position += extents[i].length;
+	}
+
+	return size == 0;
+}
+
+bool HFSVolume::findVolume(uint64 &offset) {
+	byte signature[2];
+
+	// Raw volumes and DiskCopy 4.2 images, which prepend a small header
+	const uint64 candidates[] = { 0, DISKCOPY_HEADER_SIZE };
+
+	for (uint32 i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+		if (!readData(candidates[i] + HFS_HEADER_OFFSET, signature, 2))
+			continue;
+
+		uint16 sig = READ_UINT16_BE(signature);
+
+		if (sig == HFS_SIGNATURE || sig == HFSPLUS_SIGNATURE || sig == HFSX_SIGNATURE) {
+			offset = candidates[i];
+			return true;
+		}
+	}
+
+	// Otherwise look for the first HFS partition of an Apple partition map
+	byte entry[APM_PARTYPE + 32];
+
+	if (!readData(APM_BLOCKSIZE, entry, sizeof(entry)) || entry[0] != 'P' || entry[1] != 'M')
+		return false;
+
+	uint32 entryCount = READ_UINT32_BE(entry + APM_MAPBLKCNT);
+
+	for (uint32 i = 1; i <= entryCount && i < 256; i++) {
+		if (!readData(i * APM_BLOCKSIZE, entry, sizeof(entry)) || entry[0] != 'P' || entry[1] != 'M')
+			return false;
+
+		if (!std::strncmp((const char *)entry + APM_PARTYPE, "Apple_HFS", 32)) {
+			offset = (uint64)READ_UINT32_BE(entry + APM_PYPARTSTART) * APM_BLOCKSIZE;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void readHFSExtents(const byte *data, HFSFork &fork) {
+	fork.extents.clear();
+
+	for (uint32 i = 0; i < 3; i++)
+		fork.extents.push_back(std::make_pair<uint32, uint32>(READ_UINT16_BE(data + i * 4), READ_UINT16_BE(data + i * 4 + 2)));
+}
+
+bool HFSVolume::readMasterDirectoryBlock(uint64 offset) {
+	byte mdb[MDB_SIZE];
+
+	if (!readData(offset + HFS_HEADER_OFFSET, mdb, MDB_SIZE) || READ_UINT16_BE(mdb) != HFS_SIGNATURE)
+		return false;
+
+	uint32 blockSize = READ_UINT32_BE(mdb + MDB_ALBLKSIZ);
+	uint64 blockBase = offset + READ_UINT16_BE(mdb + MDB_ALBLST) * 512ull;
+
+	if (blockSize == 0 || (blockSize & 511) != 0)
+		return false;
+
+	// HFS+ volumes are usually wrapped in an HFS volume for older systems
+	if (READ_UINT16_BE(mdb + MDB_EMBEDSIGWORD) == HFSPLUS_SIGNATURE)
+		return readVolumeHeader(blockBase + (uint64)READ_UINT16_BE(mdb + MDB_EMBEDEXTENT) * blockSize);
+
+	_hfsPlus = false;
+	_blockBase = blockBase;
+	_blockSize = blockSize;
+	_name.assign((const char *)mdb + MDB_VN + 1, std::min<uint32>(mdb[MDB_VN], 27));
+
+	HFSFork extentsFork, catalogFork;
+	extentsFork.length = READ_UINT32_BE(mdb + MDB_XTFLSIZE);
+	readHFSExtents(mdb + MDB_XTEXTREC, extentsFork);
+	catalogFork.length = READ_UINT32_BE(mdb + MDB_CTFLSIZE);
+	readHFSExtents(mdb + MDB_CTEXTREC, catalogFork);
+
+	// The catalog might be fragmented, so the extents tree comes first
+	return openBTree(EXTENTS_FILE_ID, extentsFork, _extentsOverflow) && openBTree(CATALOG_FILE_ID, catalogFork, _catalog);
+}
+
+void HFSVolume::readFork(const byte *data, HFSFork &fork) const {
+	fork.length = ((uint64)READ_UINT32_BE(data) << 32) | READ_UINT32_BE(data + 4);
+	fork.extents.clear();
+
+	for (uint32 i = 0; i < 8; i++)
+		fork.extents.push_back(std::make_pair(READ_UINT32_BE(data + 16 + i * 8), READ_UINT32_BE(data + 20 + i * 8)));
+}
+
+bool HFSVolume::readVolumeHeader(uint64 offset) {
+	byte header[VH_SIZE];
+
+	if (!readData(offset + HFS_HEADER_OFFSET, header, VH_SIZE))
+		return false;
+
+	uint16 signature = READ_UINT16_BE(header);
+
+	if (signature != HFSPLUS_SIGNATURE && signature != HFSX_SIGNATURE)
+		return false;
+
+	_hfsPlus = true;
+	_blockBase = offset;
+	_blockSize = READ_UINT32_BE(header + VH_BLOCKSIZE);
+
+	if (_blockSize == 0 || (_blockSize & 511) != 0)
+		return false;
+
+	HFSFork extentsFork, catalogFork;
+	readFork(header + VH_EXTENTSFILE, extentsFork);
+	readFork(header + VH_CATALOGFILE, catalogFork);
+
+	if (!openBTree(EXTENTS_FILE_ID, extentsFork, _extentsOverflow) || !openBTree(CATALOG_FILE_ID, catalogFork, _catalog))
+		return false;
+
+	// HFS+ keeps the volume name in the thread record of the root folder
+	std::vector<byte> node;
+	uint32 leaf = findCatalogLeaf(ROOT_FOLDER_ID);
+
+	if (leaf == 0 || !readNode(_catalog, leaf, node))
+		return true;
+
+	Record record;
+
+	for (uint16 i = 0; getRecord(_catalog, node, i, record); i++) {
+		if (READ_UINT32_BE(record.key + 2) != ROOT_FOLDER_ID || getRecordType(record) != FOLDER_THREAD_RECORD || record.dataLength < 10)
+			continue;
+
+		uint32 length = std::min<uint32>(READ_UINT16_BE(record.data + 8), (record.dataLength - 10) / 2);
+		_name = convertName(record.data + 10, length);
+		break;
+	}
+
+	return true;
+}
+
+bool HFSVolume::openBTree(uint32 fileID, const HFSFork &fork, BTree &tree) {
+	if (!resolveExtents(fileID, false, fork, tree.extents))
+		return false;
+
+	byte header[BT_NODE_DESCRIPTOR + BT_HEADER_SIZE];
+
+	if (!readExtents(tree.extents, 0, header, sizeof(header)))
+		return false;
+
+	const byte *record = header + BT_NODE_DESCRIPTOR;
+
+	tree.root = READ_UINT32_BE(record + 2);
+	tree.firstLeaf = READ_UINT32_BE(record + 10);
+	tree.nodeSize = READ_UINT16_BE(record + 18);
+	tree.maxKeyLength = READ_UINT16_BE(record + 20);
+	tree.totalNodes = READ_UINT32_BE(record + 22);
+	tree.attributes = READ_UINT32_BE(record + 38);
+
+	// HFS has no attributes, its keys are always small
+	if (!_hfsPlus)
+		tree.attributes = 0;
+
+	if (tree.nodeSize < 512 || (tree.nodeSize & (tree.nodeSize - 1)) != 0 || (uint64)tree.totalNodes * tree.nodeSize > fork.length)
+		return false;
+
+	return true;
+}
+
+uint64 HFSVolume::getBlockOffset(uint32 block) const {
+	return _blockBase + (uint64)block * _blockSize;
+}
+
+bool HFSVolume::readNode(const BTree &tree, uint32 node, std::vector<byte> &buffer) const {
+	if (node == 0 || node >= tree.totalNodes)
+		return false;
+
+	buffer.resize(tree.nodeSize);
+
+	if (!readExtents(tree.extents, (uint64)node * tree.nodeSize, &buffer[0], tree.nodeSize))
+		return false;
+
+	// The record offsets are stored backwards from the end of the node
+	return BT_NODE_DESCRIPTOR + (getRecordCount(buffer) + 1) * 2u <= tree.nodeSize;
+}
+
+bool HFSVolume::getRecord(const BTree &tree, const std::vector<byte> &node, uint32 index, Record &record) const {
+	uint16 count = getRecordCount(node);
+
+	if (index >= count)
+		return false;
+
+	uint32 start = READ_UINT16_BE(&node[tree.nodeSize - 2 * (index + 1)]);
+	uint32 end = READ_UINT16_BE(&node[tree.nodeSize - 2 * (index + 2)]);
+
+	if (start < BT_NODE_DESCRIPTOR || end > tree.nodeSize - 2 * (count + 1) || start + 2 > end)
+		return false;
+
+	bool bigKeys = (tree.attributes & BT_BIG_KEYS) != 0;
+	uint32 keyLength = bigKeys ? READ_UINT16_BE(&node[start]) : node[start];
+	uint32 keySize = (bigKeys ? 2 : 1) + keyLength;
+
+	// Index keys are padded to the maximum length unless stated otherwise
+	if (getNodeKind(node) == BT_INDEX_NODE && !(tree.attributes & BT_VARIABLE_INDEX_KEYS))
+		keySize = (bigKeys ? 2 : 1) + tree.maxKeyLength;
+
+	// The record data is word aligned
+	keySize = (keySize + 1) & ~1;
+
+	if (keySize > end - start)
+		return false;
+
+	record.key = &node[start];
+	record.keyLength = keyLength;
+	record.data = &node[start + keySize];
+	record.dataLength = end - start - keySize;
+	return true;
+}
+
+uint16 HFSVolume::getRecordType(const Record &record) const {
+	if (record.dataLength < 2)
+		return 0;
+
+	return _hfsPlus ? READ_UINT16_BE(record.data) : record.data[0];
+}
+
+uint32 HFSVolume::findCatalogLeaf(uint32 parentID) {
+	std::vector<byte> node;
+	uint32 current = _catalog.root;
+
+	// The first key of a folder's children is its thread record, which has an
+	// empty name. Searching for it only requires comparing folder ids, thus
+	// the name ordering of the file system never has to be reproduced.
+	for (uint32 depth = 0; depth < BT_MAX_DEPTH; depth++) {
+		if (!readNode(_catalog, current, node))
+			return 0;
+
+		if (getNodeKind(node) == BT_LEAF_NODE)
+			return current;
+		if (getNodeKind(node) != BT_INDEX_NODE)
+			return 0;
+
+		Record record;
+		uint32 child = 0;
+
+		for (uint16 i = 0; getRecord(_catalog, node, i, record); i++) {
+			if (record.keyLength < 6 || record.dataLength < 4)
+				return 0;
+
+			uint32 keyParentID = READ_UINT32_BE(record.key + 2);
+			bool emptyName = (_hfsPlus ? READ_UINT16_BE(record.key + 6) : record.key[6]) == 0;
+
+			if (keyParentID > parentID || (keyParentID == parentID && !emptyName)) {
+				if (i == 0)
+					child = READ_UINT32_BE(record.data);
+				break;
+			}
+
+			child = READ_UINT32_BE(record.data);
+		}
+
+		if (child == 0)
+			return 0;
+
+		current = child;
+	}
+
+	return 0;
+}
+
+std::string HFSVolume::convertName(const byte *data, uint32 length) {
+	std::string name;
+
+	// UTF-16 to UTF-8
+	for (uint32 i = 0; i < length; i++) {
+		uint32 c = READ_UINT16_BE(data + i * 2);
+
+		if (c >= 0xD800 && c < 0xDC00 && i + 1 < length) {
+			uint32 low = READ_UINT16_BE(data + i * 2 + 2);
+
+			if (low >= 0xDC00 && low < 0xE000) {
+				c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+				i++;
+			}
+		}
+
+		if (c < 0x80) {
+			name += (char)c;
+		} else if (c < 0x800) {
+			name += (char)(0xC0 | (c >> 6));
+			name += (char)(0x80 | (c & 0x3F));
+		} else if (c < 0x10000) {
+			name += (char)(0xE0 | (c >> 12));
+			name += (char)(0x80 | ((c >> 6) & 0x3F));
+			name += (char)(0x80 | (c & 0x3F));
+		} else {
+			name += (char)(0xF0 | (c >> 18));
+			name += (char)(0x80 | ((c >> 12) & 0x3F));
+			name += (char)(0x80 | ((c >> 6) & 0x3F));
+			name += (char)(0x80 | (c & 0x3F));
+		}
+	}
+
+	return name;
+}
+
+std::string HFSVolume::getCatalogName(const Record &record) const {
+	if (_hfsPlus) {
+		uint32 length = std::min<uint32>(READ_UINT16_BE(record.key + 6), (record.keyLength - 6) / 2);
+		return convertName(record.key + 8, length);
+	}
+
+	uint32 length = std::min<uint32>(record.key[6], record.keyLength - 6);
+	return std::string((const char *)record.key + 7, length);
+}
+
+bool HFSVolume::compareNames(const std::string &name1, const std::string &name2) {
+	if (name1.size() != name2.size())
+		return false;
+
+	for (uint32 i = 0; i < name1.size(); i++) {
+		byte c1 = name1[i];
+		byte c2 = name2[i];
+
+		if (c1 >= 'A' && c1 <= 'Z')
+			c1 += 'a' - 'A';
+		if (c2 >= 'A' && c2 <= 'Z')
+			c2 += 'a' - 'A';
+
+		if (c1 != c2)
+			return false;
+	}
+
+	return true;
+}
+
+bool HFSVolume::findChild(uint32 parentID, const std::string &name, Record &record, std::vector<byte> &node) {
+	uint32 current = findCatalogLeaf(parentID);
+
+	// Walk the leaves from the folder's thread record on, all of its children
+	// follow in a row
+	for (uint32 visited = 0; current != 0 && visited < _catalog.totalNodes; visited++) {
+		if (!readNode(_catalog, current, node) || getNodeKind(node) != BT_LEAF_NODE)
+			return false;
+
+		for (uint16 i = 0; getRecord(_catalog, node, i, record); i++) {
+			if (record.keyLength < 6)
+				return false;
+
+			uint32 keyParentID = READ_UINT32_BE(record.key + 2);
+
+			if (keyParentID < parentID)
+				continue;
+			if (keyParentID > parentID)
+				return false;
+
+			if (compareNames(getCatalogName(record), name))
+				return true;
+		}
+
+		current = getNextNode(node);
+	}
+
+	return false;
+}
+
+bool HFSVolume::readFile(const Record &record, HFSFile &file) const {
+	if (getRecordType(record) != FILE_RECORD)
+		return false;
+
+	if (_hfsPlus) {
+		if (record.dataLength < HFSPLUS_FILE_RECORD_SIZE)
+			return false;
+
+		file.id = READ_UINT32_BE(record.data + 8);
+		file.type = READ_UINT32_BE(record.data + 48);
+		file.creator = READ_UINT32_BE(record.data + 52);
+		readFork(record.data + 88, file.dataFork);
+		readFork(record.data + 88 + HFSPLUS_FORK_DATA_SIZE, file.resourceFork);
+		return true;
+	}
+
+	if (record.dataLength < HFS_FILE_RECORD_SIZE)
+		return false;
+
+	file.type = READ_UINT32_BE(record.data + 4);
+	file.creator = READ_UINT32_BE(record.data + 8);
+	file.id = READ_UINT32_BE(record.data + 20);
+	file.dataFork.length = READ_UINT32_BE(record.data + 26);
+	readHFSExtents(record.data + 74, file.dataFork);
+	file.resourceFork.length = READ_UINT32_BE(record.data + 36);
+	readHFSExtents(record.data + 86, file.resourceFork);
+	return true;
+}
+
+uint32 HFSVolume::getFolderID(const Record &record) const {
+	if (getRecordType(record) != FOLDER_RECORD)
+		return 0;
+
+	if (_hfsPlus)
+		return record.dataLength >= 12 ? READ_UINT32_BE(record.data + 8) : 0;
+
+	return record.dataLength >= 10 ? READ_UINT32_BE(record.data + 6) : 0;
+}
+
+bool HFSVolume::findFile(const std::string &path, HFSFile &file) {
+	std::vector<std::string> components;
+	std::string::size_type start = 0;
+
+	while (start <= path.size()) {
+		std::string::size_type end = path.find(':', start);
+
+		if (end == std::string::npos)
+			end = path.size();
+
+		if (end > start)
+			components.push_back(path.substr(start, end - start));
+
+		start = end + 1;
+	}
+
+	if (components.empty())
+		return false;
+
+	for (uint32 skip = 0; skip < 2; skip++) {
+		// Mac OS style full paths start with the volume name
+		if (skip == 1 && (components.size() < 2 || !compareNames(components[0], _name)))
+			break;
+
+		std::vector<byte> node;
+		Record record;
+		uint32 parentID = ROOT_FOLDER_ID;
+		uint32 i = skip;
+
+		for (; i < components.size() - 1; i++) {
+			if (!findChild(parentID, components[i], record, node) || (parentID = getFolderID(record)) == 0)
+				break;
+		}
+
+		if (i != components.size() - 1 || !findChild(parentID, components[i], record, node) || !readFile(record, file))
+			continue;
+
+		file.path.clear();
+
+		for (i = skip; i < components.size(); i++)
+			file.path += (i == skip ? "" : ":") + components[i];
+
+		return true;
+	}
+
+	return false;
+}
+
+bool HFSVolume::listFiles(uint32 type, std::vector<HFSFile> &files) {
+	// Folder id to parent folder id and name
+	typedef boost::unordered_map<uint32, std::pair<uint32, std::string> > FolderMap;
+	FolderMap folders;
+	std::vector<uint32> parents;
+	uint32 first = files.size();
+
+	std::vector<byte> node;
+	uint32 current = _catalog.firstLeaf;
+
+	for (uint32 visited = 0; current != 0; visited++) {
+		if (visited >= _catalog.totalNodes || !readNode(_catalog, current, node) || getNodeKind(node) != BT_LEAF_NODE)
+			return false;
+
+		Record record;
+
+		for (uint16 i = 0; getRecord(_catalog, node, i, record); i++) {
+			if (record.keyLength < 6)
+				return false;
+
+			uint32 parentID = READ_UINT32_BE(record.key + 2);
+			uint32 folderID = getFolderID(record);
+			HFSFile file;
+
+			if (folderID != 0) {
+				folders[folderID] = std::make_pair(parentID, getCatalogName(record));
+			} else if (readFile(record, file) && file.type == type) {
+				file.path = getCatalogName(record);
+				files.push_back(file);
+				parents.push_back(parentID);
+			}
+		}
+
+		current = getNextNode(node);
+	}
+
+	// Now that all folders are known build the full paths
+	for (uint32 i = first; i < files.size(); i++) {
+		uint32 parentID = parents[i - first];
+
+		for (uint32 depth = 0; parentID != ROOT_FOLDER_ID && depth < 256; depth++) {
+			FolderMap::const_iterator folder = folders.find(parentID);
+
+			if (folder == folders.end())
+				break;
+
+			files[i].path = folder->second.second + ":" + files[i].path;
+			parentID = folder->second.first;
+		}
+	}
+
+	return true;
+}
+
+bool HFSVolume::findOverflowExtents(uint32 fileID, bool resourceFork, uint32 startBlock, HFSFork &fork) {
+	if (_extentsOverflow.root == 0)
+		return false;
+
+	byte forkType = resourceFork ? 0xFF : 0x00;
+	std::vector<byte> node;
+	uint32 current = _extentsOverflow.root;
+
+	for (uint32 depth = 0; depth < BT_MAX_DEPTH; depth++) {
+		if (!readNode(_extentsOverflow, current, node))
+			return false;
+
+		int8 kind = getNodeKind(node);
+
+		if (kind != BT_INDEX_NODE && kind != BT_LEAF_NODE)
+			return false;
+
+		Record record;
+		uint32 child = 0;
+
+		for (uint16 i = 0; getRecord(_extentsOverflow, node, i, record); i++) {
+			// Keys are ordered by file id, fork type and start block
+			uint32 keyFileID, keyStartBlock;
+			byte keyForkType;
+
+			if (_hfsPlus) {
+				if (record.keyLength < 10)
+					return false;
+
+				keyForkType = record.key[2];
+				keyFileID = READ_UINT32_BE(record.key + 4);
+				keyStartBlock = READ_UINT32_BE(record.key + 8);
+			} else {
+				if (record.keyLength < 7)
+					return false;
+
+				keyForkType = record.key[1];
+				keyFileID = READ_UINT32_BE(record.key + 2);
+				keyStartBlock = READ_UINT16_BE(record.key + 6);
+			}
+
+			bool equal = keyFileID == fileID && keyForkType == forkType && keyStartBlock == startBlock;
+			bool greater = keyFileID > fileID || (keyFileID == fileID && (keyForkType > forkType || (keyForkType == forkType && keyStartBlock > startBlock)));
+
+			if (kind == BT_LEAF_NODE && equal) {
+				if (_hfsPlus) {
+					if (record.dataLength < 64)
+						return false;
+
+					HFSFork extents;
+					byte forkData[HFSPLUS_FORK_DATA_SIZE] = { 0 };
+					std::memcpy(forkData + 16, record.data, 64);
+					readFork(forkData, extents);
+					fork.extents.swap(extents.extents);
+				} else {
+					if (record.dataLength < 12)
+						return false;
+
+					readHFSExtents(record.data, fork);
+				}
+
+				return true;
+			}
+
+			if (greater)
+				break;
+
+			if (kind == BT_INDEX_NODE) {
+				if (record.dataLength < 4)
+					return false;
+
+				child = READ_UINT32_BE(record.data);
+			}
+		}
+
+		if (kind == BT_LEAF_NODE || child == 0)
+			return false;
+
+		current = child;
+	}
+
+	return false;
+}
+
+bool HFSVolume::resolveExtents(uint32 fileID, bool resourceFork, const HFSFork &fork, std::vector<HFSExtent> &extents) {
+	extents.clear();
+
+	uint64 remaining = fork.length;
+	uint32 blocks = 0;
+	HFSFork current = fork;
+
+	while (remaining > 0) {
+		uint32 previousBlocks = blocks;
+
+		for (uint32 i = 0; i < current.extents.size() && remaining > 0; i++) {
+			uint64 offset = getBlockOffset(current.extents[i].first);
+			uint64 length = std::min<uint64>((uint64)current.extents[i].second * _blockSize, remaining);
+
+			remaining -= length;
+			blocks += current.extents[i].second;
+
+			// Keep extents addressable with 32 bit lengths
+			for (; length > 0x40000000; length -= 0x40000000, offset += 0x40000000)
+				extents.push_back(HFSExtent(offset, 0x40000000));
+
+			if (length > 0)
+				extents.push_back(HFSExtent(offset, length));
+		}
+
+		if (remaining == 0)
+			break;
+
+		// The extents file itself can not overflow
+		if (blocks == previousBlocks || fileID == EXTENTS_FILE_ID || !findOverflowExtents(fileID, resourceFork, blocks, current))
+			return false;
+	}
+
+	return true;
+}
+
+bool HFSVolume::getForkExtents(const HFSFile &file, bool resourceFork, std::vector<HFSExtent> &extents) {
+	return resolveExtents(file.id, resourceFork, resourceFork ? file.resourceFork : file.dataFork, extents);
+}
@@ -0,0 +1,148 @@
+/* hfs.h: Read-only HFS and HFS+ volume reader
+ * Copyright (c) 2010-2011 Matthew Hoops (clone2727)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef HFS_H
+#define HFS_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "util.h"
+
+// A contiguous byte range of the disk image
+struct HFSExtent {
+	HFSExtent() { offset = 0; length = 0; }
+	HFSExtent(uint64 o, uint32 l) { offset = o; length = l; }
+
+	uint64 offset;
+	uint32 length;
+};
+
+// A fork as described by its catalog record. Only the first extents are
+// stored there, the rest lives in the extents overflow file.
+struct HFSFork {
+	HFSFork() { length = 0; }
+
+	uint64 length;
+	std::vector<std::pair<uint32, uint32> > extents; // Start block and block count
+};
+
+struct HFSFile {
+	HFSFile() { id = 0; type = 0; creator = 0; }
+
+	std::string path; // ':' separated, relative to the volume root
+	uint32 id;
+	uint32 type;
+	uint32 creator;
+	HFSFork dataFork;
+	HFSFork resourceFork;
+};
+
+// Reads files out of HFS and HFS+ disk images without extracting them. Raw
+// volumes, DiskCopy 4.2 images, Apple partition maps and HFS+ volumes
+// embedded in an HFS wrapper are recognized. Names are compared case
+// insensitively for ASCII only; HFS+ names are handled as UTF-8.
+class HFSVolume {
+public:
+	HFSVolume();
+	~HFSVolume();
+
+	bool open(const std::string &filename);
+	void close();
+	bool isOpen() const { return _fd != -1; }
+	bool isHFSPlus() const { return _hfsPlus; }
+
+	const std::string &getFilename() const { return _filename; }
+	const std::string &getName() const { return _name; }
+	int getFileDescriptor() const { return _fd; }
+	int64 getModificationTime() const { return _mtime; }
+
+	// Look a file up by its path, components are separated by ':'
+	bool findFile(const std::string &path, HFSFile &file);
+
+	// Walk the catalog once and collect every file of the given type
+	bool listFiles(uint32 type, std::vector<HFSFile> &files);
+
+	// Resolve a fork to the image byte ranges holding it, in fork order
+	bool getForkExtents(const HFSFile &file, bool resourceFork, std::vector<HFSExtent> &extents);
+
+private:
+	struct BTree {
+		BTree() { nodeSize = 0; root = 0; firstLeaf = 0; totalNodes = 0; maxKeyLength = 0; attributes = 0; }
+
+		std::vector<HFSExtent> extents; // Where the tree file itself is stored
+		uint32 nodeSize;
+		uint32 root;
+		uint32 firstLeaf;
+		uint32 totalNodes;
+		uint16 maxKeyLength;
+		uint32 attributes;
+	};
+
+	// A record of a B-tree node
+	struct Record {
+		const byte *key;
+		uint32 keyLength;
+		const byte *data;
+		uint32 dataLength;
+	};
+
+	bool readData(uint64 offset, byte *buffer, uint32 size) const;
+	bool readExtents(const std::vector<HFSExtent> &extents, uint64 offset, byte *buffer, uint32 size) const;
+
+	bool findVolume(uint64 &offset);
+	bool readMasterDirectoryBlock(uint64 offset);
+	bool readVolumeHeader(uint64 offset);
+	bool openBTree(uint32 fileID, const HFSFork &fork, BTree &tree);
+
+	void readFork(const byte *data, HFSFork &fork) const;
+	uint16 getRecordType(const Record &record) const;
+	uint32 getFolderID(const Record &record) const;
+	bool readFile(const Record &record, HFSFile &file) const;
+	uint64 getBlockOffset(uint32 block) const;
+
+	bool readNode(const BTree &tree, uint32 node, std::vector<byte> &buffer) const;
+	bool getRecord(const BTree &tree, const std::vector<byte> &node, uint32 index, Record &record) const;
+	static int8 getNodeKind(const std::vector<byte> &node) { return (int8)node[8]; }
+	static uint16 getRecordCount(const std::vector<byte> &node) { return READ_UINT16_BE(&node[10]); }
+	static uint32 getNextNode(const std::vector<byte> &node) { return READ_UINT32_BE(&node[0]); }
+
+	uint32 findCatalogLeaf(uint32 parentID);
+	bool findChild(uint32 parentID, const std::string &name, Record &record, std::vector<byte> &node);
+	bool findOverflowExtents(uint32 fileID, bool resourceFork, uint32 startBlock, HFSFork &fork);
+	bool resolveExtents(uint32 fileID, bool resourceFork, const HFSFork &fork, std::vector<HFSExtent> &extents);
+
+	std::string getCatalogName(const Record &record) const;
+	static std::string convertName(const byte *data, uint32 length);
+	static bool compareNames(const std::string &name1, const std::string &name2);
+
+	std::string _filename;
+	int _fd;
+	int64 _mtime;
+	bool _hfsPlus;
+	std::string _name;
+
+	uint64 _blockBase; // Offset of allocation block 0 in the image
+	uint32 _blockSize;
+
+	BTree _catalog;
+	BTree _extentsOverflow;
+};
+
+#endif
@@ -19,50 +19,185 @@
 
 #include "jumptable.h"
 
-bool JumpTableEntry::isDummy() const {
-	return rawData[0] == 0
-	    && rawData[1] == 0
-	    && rawData[2] == 0
-	    && rawData[3] == 0
-	    && rawData[4] == 0
-	    && rawData[5] == 0
-	    && rawData[6] == 0
-	    && rawData[7] == 0;
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <boost/dynamic_bitset.hpp>
+#include <boost/foreach.hpp>
+
+JumpTable::JumpTable() : _rawData(), _states(), _segmentIDs(), _functionOffsets(), _dummyCount(0) {
 }
 
-void JumpTableEntry::load(uint32 offset) {
-	// In case the segment is load already we ignore the request
-	if (isLoaded())
-		return;
+void JumpTable::assign(const byte *data, uint32 count) {
+	_rawData.assign(data, data + count * kEntrySize);
+	_states.resize(count);
+	_segmentIDs.resize(count);
+	_functionOffsets.resize(count);
+	_dummyCount = 0;
 
-	// Read the function offset
-	const uint16 functionOffset = READ_UINT16_BE(rawData + 0);
+	decode(0, count);
+}
 
-	// Caclulate the real offset
-	offset += functionOffset;
+void JumpTable::resize(uint32 count) {
+	const uint32 oldCount = getEntryCount();
 
-	// Write the JMP instruction
-	WRITE_UINT16_BE(rawData + 2, 0x4EF9);
+	// Forget about dummies we drop
+	for (uint32 i = count; i < oldCount; ++i) {
+		if (_states[i] == kStateDummy)
+			--_dummyCount;
+	}
+
+	// Zeroed entries are dummies, so there is nothing to decode
+	_rawData.resize(count * kEntrySize, 0);
+	_states.resize(count, kStateDummy);
+	_segmentIDs.resize(count, 0);
+	_functionOffsets.resize(count, 0);
+
+	if (count > oldCount)
+		_dummyCount += count - oldCount;
+}
+
+void JumpTable::update(uint32 first, const byte *data, uint32 count) {
+	assert(first + count <= getEntryCount());
+
+	for (uint32 i = first; i < first + count; ++i) {
+		if (_states[i] == kStateDummy)
+			--_dummyCount;
+	}
+
+	std::memcpy(&_rawData[first * kEntrySize], data, count * kEntrySize);
+	decode(first, count);
+}
+
+void JumpTable::decode(uint32 first, uint32 count) {
+	const byte *src = getRawData() + first * kEntrySize;
+	const uint32 end = first + count;
+	uint32 i = first;
+
+	// Classify four entries per iteration. Dummies are all zero, thus a run
+	// of them, as found at the end of most tables, takes a single compare
+	// regardless of the byte order.
+	for (; i + 4 <= end; i += 4, src += 4 * kEntrySize) {
+		uint64 words[4];
+		std::memcpy(words, src, sizeof(words));
+
+		if ((words[0] | words[1] | words[2] | words[3]) == 0) {
+			std::fill(&_states[i], &_states[i] + 4, (byte)kStateDummy);
+			std::fill(&_segmentIDs[i], &_segmentIDs[i] + 4, 0);
+			std::fill(&_functionOffsets[i], &_functionOffsets[i] + 4, 0);
+			_dummyCount += 4;
+			continue;
+		}
+
+		decodeEntry(i + 0, src + 0 * kEntrySize);
+		decodeEntry(i + 1, src + 1 * kEntrySize);
+		decodeEntry(i + 2, src + 2 * kEntrySize);
+		decodeEntry(i + 3, src + 3 * kEntrySize);
+	}
+
+	for (; i < end; ++i, src += kEntrySize)
+		decodeEntry(i, src);
+}
+
+void JumpTable::decodeEntry(uint32 index, const byte *src) {
+	// Handle the whole entry as one 64bit word
+	const uint64 entry = ((uint64)READ_UINT32_BE(src) << 32) | READ_UINT32_BE(src + 4);
+
+	byte state;
+	uint16 segmentID = 0;
+	uint32 functionOffset = 0;
 
-	// Write the offset
-	WRITE_UINT32_BE(rawData + 4, offset);
+	if (entry == 0) {
+		state = kStateDummy;
+		++_dummyCount;
+	} else if (((entry >> 32) & 0xFFFF) == 0xA9F0) {
+		// _LoadSeg at offset 2, regular entries have a MOVE.W there
+		state = kStateUnloaded32Bit;
+		segmentID = entry >> 48;
+		functionOffset = (uint32)entry;
+	} else if ((entry & 0xFFFF) == 0xA9F0) {
+		state = kStateUnloaded;
+		segmentID = (entry >> 16) & 0xFFFF;
+		functionOffset = entry >> 48;
+	} else {
+		state = kStateLoaded;
+	}
+
+	_states[index] = state;
+	_segmentIDs[index] = segmentID;
+	_functionOffsets[index] = functionOffset;
 }
 
-void JumpTableEntry::load32Bit(uint32 offset) {
+void JumpTable::load(uint32 entry, uint32 offset) {
 	// In case the segment is load already we ignore the request
-	if (isLoaded32Bit())
+	if (_states[entry] != kStateUnloaded && _states[entry] != kStateUnloaded32Bit)
 		return;
 
-	// Read the function offset
-	const uint32 functionOffset = READ_UINT32_BE(rawData + 4);
-
-	// Caclulate the real offset
-	offset += functionOffset;
+	byte *rawEntry = &_rawData[entry * kEntrySize];
 
 	// Write the JMP instruction
-	WRITE_UINT16_BE(rawData + 2, 0x4EF9);
+	WRITE_UINT16_BE(rawEntry + 2, 0x4EF9);
+
+	// Write the real offset
+	WRITE_UINT32_BE(rawEntry + 4, offset + _functionOffsets[entry]);
+
+	_states[entry] = kStateLoaded;
+}
+
+JumpTableIndex::JumpTableIndex() : _owners(), _exports(), _blocks(), _issues() {
+}
+
+void JumpTableIndex::build(const JumpTable &jumpTable, const std::vector<JumpTableBlock> &blocks, bool uninitialized) {
+	const uint32 count = jumpTable.getEntryCount();
+
+	_owners.assign(count, 0);
+	_exports.clear();
+	_blocks = blocks;
+	_issues.clear();
+
+	// Entries loaded by any segment
+	boost::dynamic_bitset<> claimed(count);
 
-	// Write the offset
-	WRITE_UINT32_BE(rawData + 4, offset);
+	BOOST_FOREACH(const JumpTableBlock &block, _blocks) {
+		assert(block.first + block.count <= count);
+
+		for (uint32 i = block.first; i < block.first + block.count; ++i) {
+			if (claimed.test(i)) {
+				const JumpTableIssue::Type type = (_owners[i] == block.segmentID) ? JumpTableIssue::kTypeDoubleLoad : JumpTableIssue::kTypeOverlap;
+				_issues.push_back(JumpTableIssue(type, i, block.segmentID, _owners[i]));
+				continue;
+			}
+
+			claimed.set(i);
+			_owners[i] = block.segmentID;
+
+			if (jumpTable.isLoaded(i, block.is32Bit)) {
+				if (!uninitialized || !jumpTable.isDummy(i))
+					_issues.push_back(JumpTableIssue(JumpTableIssue::kTypeLoaded, i, block.segmentID, 0));
+			} else if (jumpTable.getSegmentID(i) != block.segmentID) {
+				_issues.push_back(JumpTableIssue(JumpTableIssue::kTypeMismatch, i, block.segmentID, jumpTable.getSegmentID(i)));
+			}
+		}
+	}
+
+	// Collect the exports and any unloaded entry nobody claims
+	for (uint32 i = 0; i < count; ++i) {
+		if (jumpTable.isDummy(i) || jumpTable.isLoaded(i))
+			continue;
+
+		_exports.push_back(JumpTableExport(jumpTable.getSegmentID(i), i));
+
+		if (!claimed.test(i))
+			_issues.push_back(JumpTableIssue(JumpTableIssue::kTypeOrphan, i, jumpTable.getSegmentID(i), 0));
+	}
+
+	std::sort(_exports.begin(), _exports.end());
 }
 
+static bool compareExportSegment(const JumpTableExport &e1, const JumpTableExport &e2) {
+	return e1.segmentID < e2.segmentID;
+}
+
+JumpTableIndex::ExportRange JumpTableIndex::getExports(uint16 segmentID) const {
+	return std::equal_range(_exports.begin(), _exports.end(), JumpTableExport(segmentID, 0), compareExportSegment);
+}
@@ -22,58 +22,347 @@
 
 #include "util.h"
 
+#include <vector>
+#include <utility>
+
 /**
- * A jump table entry.
+ * The jump table of an executable.
+ *
+ * The entries are kept as one contiguous block of raw big endian 8 byte
+ * records, exactly as they appear in the memory dump. The fields needed
+ * while loading segments are decoded once into parallel arrays.
+ *
+ * An unloaded entry of a regular segment looks like:
+ *   function offset (2), MOVE.W #segment id,-(SP) (4), _LoadSeg (2)
+ * An unloaded entry of a 32bit segment looks like:
+ *   segment id (2), _LoadSeg (2), function offset (4)
+ * A loaded entry contains a JMP to the absolute function address at offset
+ * 2, an entry consisting of zeros only is a dummy.
  */
-struct JumpTableEntry {
+class JumpTable {
+public:
+	/**
+	 * The size of a single entry in bytes.
+	 */
+	static const uint32 kEntrySize = 8;
+
+	JumpTable();
+
+	/**
+	 * Replace the table with the given raw entries.
+	 *
+	 * @param data The raw entries.
+	 * @param count The number of entries.
+	 */
+	void assign(const byte *data, uint32 count);
+
+	/**
+	 * Resize the table, added entries are dummies.
+	 *
+	 * @param count The new number of entries.
+	 */
+	void resize(uint32 count);
+
+	/**
+	 * Overwrite a range of entries with new raw data.
+	 *
+	 * @param first The first entry to overwrite.
+	 * @param data The raw entries.
+	 * @param count The number of entries.
+	 */
+	void update(uint32 first, const byte *data, uint32 count);
+
+	/**
+	 * Query the number of entries.
+	 */
+	uint32 getEntryCount() const { return _states.size(); }
+
+	/**
+	 * Query the number of dummy entries.
+	 */
+	uint32 getDummyCount() const { return _dummyCount; }
+
+	/**
+	 * Query the raw entries, getEntryCount() * kEntrySize bytes.
+	 */
+	const byte *getRawData() const { return _rawData.empty() ? 0 : &_rawData[0]; }
+
 	/**
-	 * The raw data of the entry.
+	 * Query the raw data of an entry.
 	 */
-	byte rawData[8];
+	const byte *getRawEntry(uint32 entry) const { return &_rawData[entry * kEntrySize]; }
 
 	/**
 	 * Check whether the entry is a dummy.
 	 */
-	bool isDummy() const;
+	bool isDummy(uint32 entry) const { return _states[entry] == kStateDummy; }
 
 	/**
-	 * Check whether the referenced segment is load or not.
+	 * Check whether the entry is loaded.
 	 */
-	bool isLoaded() const { return READ_UINT16_BE(rawData + 6) != 0xA9F0; }
+	bool isLoaded(uint32 entry) const { return _states[entry] == kStateLoaded; }
 
 	/**
-	 * Check whether the referenced 32bit segment is load or not.
+	 * Check whether the entry can not be loaded by a segment anymore.
+	 *
+	 * @param entry The entry to check.
+	 * @param is32Bit Whether the loading segment is a 32bit segment.
 	 */
-	bool isLoaded32Bit() const { return  READ_UINT16_BE(rawData + 2) != 0xA9F0; }
+	bool isLoaded(uint32 entry, bool is32Bit) const {
+		return _states[entry] != (is32Bit ? kStateUnloaded32Bit : kStateUnloaded);
+	}
 
 	/**
 	 * Query the referenced segment ID of the entry.
 	 *
 	 * This only returns a correct segment ID, when the entry is not yet loaded.
 	 */
-	uint16 getSegmentID() const { return READ_UINT16_BE(rawData + 4); }
+	uint16 getSegmentID(uint32 entry) const { return _segmentIDs[entry]; }
 
 	/**
-	 * Query the referenced segment ID of the entry from a 32bit segment.
+	 * Query the function offset inside the referenced segment.
 	 *
-	 * This only returns a correct segment ID, when the entry is not yet loaded.
+	 * This only returns a correct offset, when the entry is not yet loaded.
 	 */
-	uint16 getSegmentID32Bit() const { return READ_UINT16_BE(rawData + 0); }
+	uint32 getFunctionOffset(uint32 entry) const { return _functionOffsets[entry]; }
 
 	/**
 	 * Adjust the entry on segment load.
 	 *
+	 * In case the entry is loaded already the request is ignored.
+	 *
+	 * @param entry The entry to load.
 	 * @param offset The base offset of the segment.
 	 */
-	void load(uint32 offset);
+	void load(uint32 entry, uint32 offset);
 
+private:
 	/**
-	 * Load entry from an 32bit segment.
+	 * The state of an entry.
+	 */
+	enum State {
+		kStateDummy,
+		kStateUnloaded,
+		kStateUnloaded32Bit,
+		kStateLoaded
+	};
+
+	/**
+	 * Decode a range of entries from the raw data.
+	 */
+	void decode(uint32 first, uint32 count);
+
+	/**
+	 * Decode a single entry from the raw data.
+	 */
+	void decodeEntry(uint32 index, const byte *src);
+
+	/**
+	 * The raw entries.
+	 */
+	std::vector<byte> _rawData;
+
+	/**
+	 * The state of each entry.
+	 */
+	std::vector<byte> _states;
+
+	/**
+	 * The segment ID of each unloaded entry.
+	 */
+	std::vector<uint16> _segmentIDs;
+
+	/**
+	 * The function offset of each unloaded entry.
+	 */
+	std::vector<uint32> _functionOffsets;
+
+	/**
+	 * The number of dummy entries.
+	 */
+	uint32 _dummyCount;
+};
+
+/**
+ * A range of jump table entries a segment loads.
+ */
+struct JumpTableBlock {
+	JumpTableBlock() : segmentID(0), first(0), count(0), is32Bit(false) {}
+	JumpTableBlock(uint16 s, uint32 f, uint32 c, bool b) : segmentID(s), first(f), count(c), is32Bit(b) {}
+
+	/**
+	 * The segment loading the entries.
+	 */
+	uint16 segmentID;
+
+	/**
+	 * The first entry.
+	 */
+	uint32 first;
+
+	/**
+	 * The number of entries.
+	 */
+	uint32 count;
+
+	/**
+	 * Whether the entries are loaded by a 32bit segment.
+	 */
+	bool is32Bit;
+};
+
+/**
+ * An entry referencing a segment.
+ */
+struct JumpTableExport {
+	JumpTableExport() : segmentID(0), entry(0) {}
+	JumpTableExport(uint16 s, uint32 e) : segmentID(s), entry(e) {}
+
+	bool operator<(const JumpTableExport &e) const {
+		if (segmentID != e.segmentID)
+			return segmentID < e.segmentID;
+		return entry < e.entry;
+	}
+
+	/**
+	 * The referenced segment.
+	 */
+	uint16 segmentID;
+
+	/**
+	 * The entry.
+	 */
+	uint32 entry;
+};
+
+/**
+ * A problem found while validating the jump table.
+ */
+struct JumpTableIssue {
+	enum Type {
+		/**
+		 * The entry is loaded by two different segments.
+		 */
+		kTypeOverlap,
+
+		/**
+		 * The entry is loaded twice by the same segment.
+		 */
+		kTypeDoubleLoad,
+
+		/**
+		 * The entry is loaded already, before any segment is.
+		 */
+		kTypeLoaded,
+
+		/**
+		 * The entry references another segment than the one loading it.
+		 */
+		kTypeMismatch,
+
+		/**
+		 * The entry references a segment but is never loaded.
+		 */
+		kTypeOrphan
+	};
+
+	JumpTableIssue(Type t, uint32 e, uint16 s, uint16 o) : type(t), entry(e), segmentID(s), otherSegmentID(o) {}
+
+	/**
+	 * The kind of the problem.
+	 */
+	Type type;
+
+	/**
+	 * The entry affected.
+	 */
+	uint32 entry;
+
+	/**
+	 * The segment loading the entry, for orphans the referenced segment.
+	 */
+	uint16 segmentID;
+
+	/**
+	 * The segment which loaded the entry before or the one referenced by it.
+	 */
+	uint16 otherSegmentID;
+};
+
+/**
+ * Index of which segment owns which jump table entries.
+ *
+ * It is built once from the jump table as stored in CODE0 and the blocks
+ * claimed by all segments, and validated in the same pass.
+ */
+class JumpTableIndex {
+public:
+	typedef std::vector<JumpTableExport>::const_iterator ExportIterator;
+	typedef std::pair<ExportIterator, ExportIterator> ExportRange;
+
+	JumpTableIndex();
+
+	/**
+	 * Build the index.
 	 *
-	 * @param offset The base offset of the segment.
+	 * @param jumpTable The jump table before any segment is loaded.
+	 * @param blocks The blocks claimed by all segments.
+	 * @param uninitialized Whether dummy entries are filled in while loading,
+	 *                      in which case claiming them is fine.
+	 */
+	void build(const JumpTable &jumpTable, const std::vector<JumpTableBlock> &blocks, bool uninitialized);
+
+	/**
+	 * Query the segment loading an entry, 0 in case none does.
+	 */
+	uint16 getOwner(uint32 entry) const { return _owners[entry]; }
+
+	/**
+	 * Query the entries exported by a segment, as referenced by the jump
+	 * table, sorted by entry.
 	 */
-	void load32Bit(uint32 offset);
+	ExportRange getExports(uint16 segmentID) const;
+
+	/**
+	 * Query all entries referencing a segment, sorted by segment and entry.
+	 */
+	const std::vector<JumpTableExport> &getExports() const { return _exports; }
+
+	/**
+	 * Query the blocks claimed by all segments.
+	 */
+	const std::vector<JumpTableBlock> &getBlocks() const { return _blocks; }
+
+	/**
+	 * Query the problems found.
+	 */
+	const std::vector<JumpTableIssue> &getIssues() const { return _issues; }
+
+	/**
+	 * Check whether the jump table can be loaded without conflicts.
+	 */
+	bool isValid() const { return _issues.empty(); }
+
+private:
+	/**
+	 * The segment loading each entry.
+	 */
+	std::vector<uint16> _owners;
+
+	/**
+	 * The unloaded entries, sorted by referenced segment.
+	 */
+	std::vector<JumpTableExport> _exports;
+
+	/**
+	 * The blocks claimed by the segments.
+	 */
+	std::vector<JumpTableBlock> _blocks;
+
+	/**
+	 * The problems found.
+	 */
+	std::vector<JumpTableIssue> _issues;
 };
 
 #endif
-
@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2011 Johannes Schickel (LordHoto)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "layout.h"
+
+#include <algorithm>
+#include <map>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+
+SegmentLayout::SegmentLayout() : _alignment(1), _order(kOrderID), _customOrder() {
+}
+
+void SegmentLayout::setAlignment(uint32 alignment) throw(std::exception) {
+	if (!alignment || (alignment & (alignment - 1)))
+		throw std::runtime_error("Segment alignment " + boost::lexical_cast<std::string>(alignment) + " is no power of two");
+
+	_alignment = alignment;
+}
+
+void SegmentLayout::setCustomOrder(const std::vector<uint16> &ids) {
+	_customOrder = ids;
+	_order = kOrderCustom;
+}
+
+static bool compareID(const SegmentPlacement *s1, const SegmentPlacement *s2) {
+	return s1->id < s2->id;
+}
+
+static bool compareSize(const SegmentPlacement *s1, const SegmentPlacement *s2) {
+	if (s1->size != s2->size)
+		return s1->size > s2->size;
+	return s1->id < s2->id;
+}
+
+uint32 SegmentLayout::plan(std::vector<SegmentPlacement> &segments, uint32 start) const throw(std::exception) {
+	// Determine the order to place the segments in
+	std::vector<SegmentPlacement *> order;
+	BOOST_FOREACH(SegmentPlacement &segment, segments)
+		order.push_back(&segment);
+
+	std::sort(order.begin(), order.end(), (_order == kOrderSize) ? compareSize : compareID);
+
+	if (_order == kOrderCustom) {
+		// Move the listed segments to the front, keeping the others in id order
+		std::map<uint16, uint32> ranks;
+		for (uint32 i = 0; i < _customOrder.size(); ++i) {
+			if (!ranks.insert(std::make_pair(_customOrder[i], i)).second)
+				throw std::runtime_error("Segment " + boost::lexical_cast<std::string>(_customOrder[i]) + " is listed twice in the segment order");
+		}
+
+		std::vector<SegmentPlacement *> custom(_customOrder.size());
+		std::vector<SegmentPlacement *> rest;
+
+		BOOST_FOREACH(SegmentPlacement *segment, order) {
+			std::map<uint16, uint32>::const_iterator rank = ranks.find(segment->id);
+
+			if (rank != ranks.end())
+				custom[rank->second] = segment;
+			else
+				rest.push_back(segment);
+		}
+
+		for (uint32 i = 0; i < custom.size(); ++i) {
+			if (!custom[i])
+				throw std::runtime_error("Segment " + boost::lexical_cast<std::string>(_customOrder[i]) + " of the segment order does not exist");
+		}
+
+		order.swap(custom);
+		order.insert(order.end(), rest.begin(), rest.end());
+	}
+
+	// Place the segments
+	uint64 offset = start;
+
+	BOOST_FOREACH(SegmentPlacement *segment, order) {
+		offset = (offset + _alignment - 1) & ~(uint64)(_alignment - 1);
+		segment->offset = offset;
+		offset += segment->size;
+
+		if (offset > 0xFFFFFFFF)
+			throw std::runtime_error("Segment layout exceeds 4GB");
+	}
+
+	return offset;
+}
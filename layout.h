@@ -0,0 +1,153 @@
+/**
+ * Copyright (c) 2011 Johannes Schickel (LordHoto)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "util.h"
+
+#include <stdexcept>
+#include <vector>
+
+/**
+ * The place of a code segment in the memory dump.
+ */
+struct SegmentPlacement {
+	SegmentPlacement() : id(0), size(0), offset(0) {}
+	SegmentPlacement(uint16 i, uint32 s) : id(i), size(s), offset(0) {}
+
+	/**
+	 * The id of the segment.
+	 */
+	uint16 id;
+
+	/**
+	 * The size of the segment in the memory dump.
+	 */
+	uint32 size;
+
+	/**
+	 * The offset of the segment in the memory dump.
+	 */
+	uint32 offset;
+};
+
+/**
+ * Plans where the code segments are placed in the memory dump.
+ *
+ * By default the segments are packed back to back in id order. They may be
+ * aligned, for example to page boundaries so that every segment of the dump
+ * can be mapped or protected on its own, and ordered differently. The gaps
+ * between segments are zero filled.
+ */
+class SegmentLayout {
+public:
+	/**
+	 * Alignment of segments to cache lines.
+	 */
+	static const uint32 kCacheLineAlignment = 64;
+
+	/**
+	 * Alignment of segments to pages.
+	 */
+	static const uint32 kPageAlignment = 4096;
+
+	/**
+	 * The order the segments are placed in.
+	 */
+	enum Order {
+		/**
+		 * Ascending segment id.
+		 */
+		kOrderID,
+
+		/**
+		 * Descending segment size, segments of the same size by id.
+		 */
+		kOrderSize,
+
+		/**
+		 * The order given by setCustomOrder(), remaining segments follow in id
+		 * order.
+		 */
+		kOrderCustom
+	};
+
+	SegmentLayout();
+
+	/**
+	 * Set the alignment of the segment offsets.
+	 *
+	 * @param alignment The alignment, a power of two.
+	 * @throws std::exception Invalid alignment.
+	 */
+	void setAlignment(uint32 alignment) throw(std::exception);
+
+	/**
+	 * Query the alignment of the segment offsets.
+	 */
+	uint32 getAlignment() const { return _alignment; }
+
+	/**
+	 * Set the order the segments are placed in.
+	 */
+	void setOrder(Order order) { _order = order; }
+
+	/**
+	 * Query the order the segments are placed in.
+	 */
+	Order getOrder() const { return _order; }
+
+	/**
+	 * Place segments in the given order, this selects kOrderCustom.
+	 *
+	 * @param ids The segment ids.
+	 */
+	void setCustomOrder(const std::vector<uint16> &ids);
+
+	/**
+	 * Plan the layout.
+	 *
+	 * @param segments The segments with their ids and sizes. Their offsets
+	 *                 are filled in, the order of the list is kept.
+	 * @param start Where the first segment may be placed.
+	 * @return The end of the last segment.
+	 * @throws std::exception The custom order names unknown segments or the
+	 *                        layout does not fit into 32bit.
+	 */
+	uint32 plan(std::vector<SegmentPlacement> &segments, uint32 start) const throw(std::exception);
+
+private:
+	/**
+	 * The alignment of the segment offsets.
+	 */
+	uint32 _alignment;
+
+	/**
+	 * The order the segments are placed in.
+	 */
+	Order _order;
+
+	/**
+	 * The segment ids for kOrderCustom.
+	 */
+	std::vector<uint16> _customOrder;
+};
+
+#endif
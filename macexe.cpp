@@ -19,63 +19,89 @@
 
 #include "macexe.h"
 #include "staticdata.h"
+#include "bereader.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <boost/lexical_cast.hpp>
 #include <boost/format.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/foreach.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/thread/thread.hpp>
 
-const uint32 kCodeTag = 0x434F4445;
+Executable::Executable(const std::string &filename, DirectoryCache *directoryCache, const std::string &cacheDirectory) throw(std::exception)
+    : _resFork(), _code0(), _codeSegments(), _jumpTableIndex(), _memory(nullptr), _memorySize(0), _relocationTables(), _threadCount(1), _segmentLayout(), _segmentPlacements(), _mappedOutput(false), _loaderManager(nullptr) {
+	_loaderManager = new StaticDataLoaderManager(*this);
+
+	// Try to load the resource fork of the given file. The file is mapped into
+	// memory, so the segments can be parsed without copying the resource data.
+	_resFork.setDirectoryCache(directoryCache);
+	_resFork.setCacheDirectory(cacheDirectory);
+	if (!_resFork.load(filename.c_str(), true))
+		throw std::runtime_error("Could not load file " + filename);
 
-Executable::Executable(const std::string &filename) throw(std::exception)
-    : _resFork(), _code0(), _codeSegments(), _memory(nullptr), _memorySize(0), _loaderManager(nullptr) {
+	loadSegments(filename);
+}
+
+Executable::Executable(HFSVolume &volume, const HFSFile &file) throw(std::exception)
+    : _resFork(), _code0(), _codeSegments(), _jumpTableIndex(), _memory(nullptr), _memorySize(0), _relocationTables(), _threadCount(1), _segmentLayout(), _segmentPlacements(), _mappedOutput(false), _loaderManager(nullptr) {
 	_loaderManager = new StaticDataLoaderManager(*this);
 
-	// Try to load the resource fork of the given file
-	if (!_resFork.load(filename.c_str()))
+	const std::string filename = volume.getFilename() + ":" + file.path;
+	if (!_resFork.load(volume, file))
 		throw std::runtime_error("Could not load file " + filename);
 
+	loadSegments(filename);
+}
+
+void Executable::loadSegments(const std::string &filename) throw(std::exception) {
 	// Initialize the Code 0 segment
-	DataPair *data = _resFork.getResource(kCodeTag, 0);
+	DataView data = _resFork.getResourceView(kCodeTag, 0);
 	// In case no Code 0 segment is present it is definitly no valid executable
-	if (data == nullptr)
+	if (data.data == nullptr)
 		throw std::runtime_error("File " + filename + " does not contain any CODE 0 segment");
 
-	try {
-		_code0 = std::auto_ptr<Code0Segment>(new Code0Segment(*data));
-	} catch (std::exception &e) {
-		destroy(data);
-		throw;
-	}
-
-	destroy(data);
+	_code0 = std::auto_ptr<Code0Segment>(new Code0Segment(data));
 
 	// Load all other segments
-	std::vector<uint16> idArray = _resFork.getIDArray(kCodeTag);
-	_codeSegmentsSize = 0;
+	ResourceFork::IndexRange codeRange = _resFork.getIDRange(kCodeTag);
+
+	for (ResourceFork::IndexIterator it = codeRange.first; it != codeRange.second; ++it) {
+		const uint16 id = it->id;
 
-	BOOST_FOREACH(uint16 id, idArray) {
 		// Segment 0 is loaded already, thus skip it
 		if (id == 0)
 			continue;
 
-		DataPair *data = _resFork.getResource(kCodeTag, id);
-		if (data == nullptr)
+		// Only the header is read here, compressed segments are decompressed
+		// just as far as the header goes. The segment data is read straight
+		// into the memory dump when loading.
+		byte header[sizeof(Code32Header)];
+		uint32 headerSize = sizeof(header);
+		uint32 length;
+
+		if (!_resFork.readResourceStart(kCodeTag, id, header, headerSize, length))
 			throw std::runtime_error("Failed to load CODE segment " + boost::lexical_cast<std::string>(id));
 
 		try {
-			boost::shared_ptr<CodeSegment> seg = _codeSegments[id] = boost::make_shared<CodeSegment>(*_code0, id, _resFork.getFilename(kCodeTag, id), *data);
-			_codeSegmentsSize += seg->getSegmentSize();
+			_codeSegments[id] = boost::make_shared<CodeSegment>(*_code0, id, _resFork.getFilename(kCodeTag, id), DataView(header, headerSize), length);
 		} catch (std::exception &e) {
-			destroy(data);
 			throw std::runtime_error("CODE segment " + boost::lexical_cast<std::string>(id) + " loading error: " + e.what());
 		}
-
-		destroy(data);
 	}
+
+	// Index the jump table entries of all segments
+	std::vector<JumpTableBlock> blocks;
+	BOOST_FOREACH(const CodeSegmentMap::value_type &i, _codeSegments)
+		blocks.insert(blocks.end(), i.second->getJumpTableBlocks().begin(), i.second->getJumpTableBlocks().end());
+
+	_jumpTableIndex.build(_code0->getJumpTable(), blocks, _code0->isJumpTableUninitialized());
 }
 
 Executable::~Executable() {
@@ -93,8 +119,139 @@ void Executable::outputInfo(std::ostream &out) const throw() {
 		i.second->outputHeader(out);
 }
 
+bool Executable::outputJumpTableIndex(std::ostream &out) const throw() {
+	out << "Jump table ownership\n"
+	    << "====================\n";
+
+	BOOST_FOREACH(const CodeSegmentMap::value_type &i, _codeSegments) {
+		const JumpTableIndex::ExportRange exports = _jumpTableIndex.getExports(i.first);
+
+		out << "Segment " << i.first << ": " << (exports.second - exports.first) << " exported entries";
+		BOOST_FOREACH(const JumpTableBlock &block, i.second->getJumpTableBlocks())
+			out << ", loads " << block.first << "-" << (block.first + block.count - 1);
+		out << "\n";
+	}
+
+	BOOST_FOREACH(const JumpTableIssue &issue, _jumpTableIndex.getIssues()) {
+		out << "Entry " << issue.entry << ": ";
+
+		switch (issue.type) {
+		case JumpTableIssue::kTypeOverlap:
+			out << "loaded by segment " << issue.segmentID << " and segment " << issue.otherSegmentID;
+			break;
+
+		case JumpTableIssue::kTypeDoubleLoad:
+			out << "loaded twice by segment " << issue.segmentID;
+			break;
+
+		case JumpTableIssue::kTypeLoaded:
+			out << "loaded already before segment " << issue.segmentID;
+			break;
+
+		case JumpTableIssue::kTypeMismatch:
+			out << "loaded by segment " << issue.segmentID << " but references segment " << issue.otherSegmentID;
+			break;
+
+		case JumpTableIssue::kTypeOrphan:
+			out << "references segment " << issue.segmentID << " but is never loaded";
+			break;
+		}
+
+		out << "\n";
+	}
+
+	out << (_jumpTableIndex.isValid() ? "No conflicts\n" : "") << std::endl;
+	return _jumpTableIndex.isValid();
+}
+
+/**
+ * A memory dump file mapped into memory while it is written.
+ *
+ * The blocks of the file are reserved up front, thus running out of disk
+ * space is reported here instead of faulting on a write to the mapping.
+ * The contents start out zeroed and pages which are never written are not
+ * backed by any memory.
+ */
+class MappedDumpFile {
+public:
+	MappedDumpFile(const std::string &filename, uint32 size) throw(std::exception) : _filename(filename), _data(0), _size(size) {
+		const int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+		if (fd < 0)
+			throw std::runtime_error("Could not open file " + filename + " for writing");
+
+		if (size && posix_fallocate(fd, 0, size) != 0) {
+			::close(fd);
+			remove();
+			throw std::runtime_error("Could not reserve " + boost::lexical_cast<std::string>(size) + " bytes for file " + filename);
+		}
+
+		void *mapping = size ? mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : 0;
+		::close(fd);
+
+		if (mapping == MAP_FAILED) {
+			remove();
+			throw std::runtime_error("Could not map file " + filename);
+		}
+
+		_data = (byte *)mapping;
+	}
+
+	~MappedDumpFile() {
+		if (_data)
+			munmap(_data, _size);
+	}
+
+	byte *getData() { return _data; }
+
+	/**
+	 * Write the mapped contents back to the file.
+	 *
+	 * @throws std::exception Errors on writing.
+	 */
+	void sync() throw(std::exception) {
+		if (_data && msync(_data, _size, MS_SYNC) != 0)
+			throw std::runtime_error("Could not write file " + _filename);
+	}
+
+	/**
+	 * Remove the incomplete file.
+	 */
+	void remove() {
+		unlink(_filename.c_str());
+	}
+
+private:
+	std::string _filename;
+	byte *_data;
+	uint32 _size;
+};
+
 void Executable::writeMemoryDump(const std::string &filename, std::ostream &outInfo) throw(std::exception) {
+	delete[] _memory;
+	_memory = nullptr;
+	_memorySize = planLayout();
+
+	if (_mappedOutput) {
+		// Load the executable straight into the file
+		MappedDumpFile file(filename, _memorySize);
+		_memory = file.getData();
+
+		try {
+			loadIntoMemory(outInfo);
+			file.sync();
+		} catch (...) {
+			_memory = nullptr;
+			file.remove();
+			throw;
+		}
+
+		_memory = nullptr;
+		return;
+	}
+
 	// Load the executable
+	_memory = new uint8[_memorySize];
+	std::memset(_memory, 0, _memorySize);
 	loadIntoMemory(outInfo);
 
 	std::ofstream out(filename.c_str(), std::ios::out | std::ios::binary);
@@ -109,37 +266,152 @@ void Executable::writeMemoryDump(const std::string &filename, std::ostream &outI
 	_memory = nullptr;
 }
 
-void Executable::loadIntoMemory(std::ostream &out) throw(std::exception) {
-	// Allocate enough memory for the executable
-	delete[] _memory;
-	_memorySize = _code0->getSegmentSize() + _codeSegmentsSize;
-	_memory = new uint8[_memorySize];
-	std::memset(_memory, 0, _memorySize);
+/**
+ * Segments shared between the threads copying them into memory.
+ */
+struct SegmentCopyQueue {
+	SegmentCopyQueue(ResourceFork &r, const Code0Segment &c, uint8 *m, uint32 s)
+	    : resFork(r), code0(c), memory(m), memorySize(s), segments(), offsets(), relocations(), errors(), failed(), next(0), mutex() {}
+
+	ResourceFork &resFork;
+	const Code0Segment &code0;
+	uint8 *memory;
+	uint32 memorySize;
+
+	std::vector<const CodeSegment *> segments;
+	std::vector<uint32> offsets;
+
+	/**
+	 * The relocation tables decoded for each segment.
+	 */
+	std::vector<std::vector<RelocationTable> > relocations;
+
+	/**
+	 * The error of each segment which could not be copied.
+	 */
+	std::vector<std::string> errors;
+	std::vector<bool> failed;
+
+	/**
+	 * The next segment to copy.
+	 */
+	uint next;
+	boost::mutex mutex;
+};
+
+/**
+ * Copy segments from the queue until it is empty.
+ *
+ * The segments are written to disjoint ranges of the memory, thus only
+ * taking the next segment needs to be synchronized.
+ */
+static void copySegments(SegmentCopyQueue *queue) {
+	while (true) {
+		uint segment;
+
+		{
+			boost::lock_guard<boost::mutex> lock(queue->mutex);
+			if (queue->next >= queue->segments.size())
+				return;
+			segment = queue->next++;
+		}
+
+		try {
+			queue->segments[segment]->copyIntoMemory(queue->resFork, queue->code0, queue->memory, queue->offsets[segment], queue->memorySize, queue->relocations[segment]);
+		} catch (std::exception &e) {
+			boost::lock_guard<boost::mutex> lock(queue->mutex);
+			queue->errors[segment] = e.what();
+			queue->failed[segment] = true;
+		}
+	}
+}
 
-	// The current offset in the memory dump
-	uint32 offset = _code0->getSegmentSize();
+void Executable::writeRelocationFile(const std::string &filename) const throw(std::exception) {
+	if (!_memorySize)
+		throw std::runtime_error("No memory dump was written yet");
 
+	// Every jump table entry loaded by a segment contains an absolute address
+	const JumpTable &jumpTable = _code0->getJumpTable();
+	std::vector<uint32> jumpTableOffsets;
+
+	BOOST_FOREACH(const JumpTableBlock &block, _jumpTableIndex.getBlocks()) {
+		for (uint32 entry = block.first; entry < block.first + block.count; ++entry) {
+			if (jumpTable.isLoaded(entry))
+				jumpTableOffsets.push_back(_code0->getJumpTableOffset() + entry * JumpTable::kEntrySize + 4);
+		}
+	}
+
+	std::sort(jumpTableOffsets.begin(), jumpTableOffsets.end());
+
+	std::vector<RelocationTable> tables = _relocationTables;
+	tables.push_back(RelocationTable(RelocationTable::kTypeJumpTable));
+	tables.back().assign(jumpTableOffsets);
+
+	RelocationFile::write(filename, 0, _memorySize, tables);
+}
+
+uint32 Executable::planLayout() throw(std::exception) {
+	// Plan where the segments are placed behind CODE0
+	_segmentPlacements.clear();
+	BOOST_FOREACH(const CodeSegmentMap::value_type &i, _codeSegments)
+		_segmentPlacements.push_back(SegmentPlacement(i.first, i.second->getSegmentSize()));
+
+	return _segmentLayout.plan(_segmentPlacements, _code0->getSegmentSize());
+}
+
+void Executable::loadIntoMemory(std::ostream &out) throw(std::exception) {
 	// Output the a5 base address
 	out << boost::format("A5 base is at 0x%1$08X\n") % _code0->getApplicationGlobalsSize()
 	    << boost::format("Jump table starts at 0x%1$08X\n") % _code0->getJumpTableOffset()
 	    << boost::format("Number of jump table entries %1$d\n") % _code0->getJumpTableEntryCount();
 
+	SegmentCopyQueue queue(_resFork, *_code0, _memory, _memorySize);
+	_relocationTables.clear();
+
+	for (uint i = 0; i < _segmentPlacements.size(); ++i) {
+		queue.segments.push_back(_codeSegments[_segmentPlacements[i].id].get());
+		queue.offsets.push_back(_segmentPlacements[i].offset);
+	}
+
+	queue.relocations.resize(queue.segments.size());
+
+	// Copy and relocate the segments in parallel. The jump table and the
+	// static data loaders are still processed in segment order below, since
+	// loaders may rewrite the jump table.
+	const bool parallel = _threadCount > 1 && queue.segments.size() > 1;
+
+	if (parallel) {
+		queue.errors.resize(queue.segments.size());
+		queue.failed.resize(queue.segments.size());
+
+		boost::thread_group threads;
+		for (uint i = 0; i < _threadCount && i < queue.segments.size(); ++i)
+			threads.create_thread(boost::bind(copySegments, &queue));
+		threads.join_all();
+	}
+
 	// Load all the segments
-	BOOST_FOREACH(const CodeSegmentMap::value_type &i, _codeSegments) {
+	for (uint i = 0; i < queue.segments.size(); ++i) {
+		const CodeSegment &segment = *queue.segments[i];
+		const uint32 offset = queue.offsets[i];
+
 		// Load the segment
-		i.second->loadIntoMemory(*_code0, _memory, offset, _memorySize);
+		if (!parallel)
+			segment.copyIntoMemory(_resFork, *_code0, _memory, offset, _memorySize, queue.relocations[i]);
+		else if (queue.failed[i])
+			throw std::runtime_error(queue.errors[i]);
+
+		_relocationTables.insert(_relocationTables.end(), queue.relocations[i].begin(), queue.relocations[i].end());
+
+		segment.loadJumpTable(*_code0, offset);
 
 		// Output information about the segment
-		out << boost::format("Segment %1$d \"%2$s\" starts at offset 0x%3$08X\n") % i.first % i.second->getName() % offset;
+		out << boost::format("Segment %1$d \"%2$s\" starts at offset 0x%3$08X\n") % segment.getID() % segment.getName() % offset;
 
 		// Try to load static data from the segment
-		_loaderManager->loadFromSegment(*i.second, offset, i.second->getSegmentSize(), out);
-
-		// Adjust offset for the next entry
-		offset += i.second->getSegmentSize();
+		_loaderManager->loadFromSegment(segment, offset, segment.getSegmentSize(), out);
 	}
 
 	// Finally load the CODE0 segment
 	_code0->loadIntoMemory(_memory, _memorySize);
 }
-
@@ -24,12 +24,15 @@
 #include "jumptable.h"
 #include "code0.h"
 #include "code.h"
+#include "relocation.h"
+#include "layout.h"
 
 #include <stdexcept>
 #include <string>
 #include <ostream>
 #include <memory>
 #include <map>
+#include <vector>
 #include <boost/shared_ptr.hpp>
 
 // Forward from staticdata.h
@@ -44,9 +47,20 @@ public:
 	 * Initial load of an executable from a file.
 	 *
 	 * @param filename The file where to load from.
+	 * @param directoryCache Optional cache used to look up resource fork sidecar files.
+	 * @param cacheDirectory Optional directory where parsed resource maps are cached.
 	 * @throws std::exception Errors on loading.
 	 */
-	Executable(const std::string &filename) throw(std::exception);
+	Executable(const std::string &filename, DirectoryCache *directoryCache = 0, const std::string &cacheDirectory = std::string()) throw(std::exception);
+
+	/**
+	 * Initial load of an executable from a file inside a disk image.
+	 *
+	 * @param volume The opened disk image.
+	 * @param file The file, as found in the volume's catalog.
+	 * @throws std::exception Errors on loading.
+	 */
+	Executable(HFSVolume &volume, const HFSFile &file) throw(std::exception);
 
 	/**
 	 * Destructor of the Executable object.
@@ -60,6 +74,14 @@ public:
 	 */
 	void outputInfo(std::ostream &out) const throw();
 
+	/**
+	 * Output which segment loads which jump table entries and any conflicts.
+	 *
+	 * @param out The stream where to output to.
+	 * @return true in case the jump table can be loaded without conflicts.
+	 */
+	bool outputJumpTableIndex(std::ostream &out) const throw();
+
 	/**
 	 * Output a memory dump of the executable to the given file.
 	 *
@@ -69,6 +91,68 @@ public:
 	 */
 	void writeMemoryDump(const std::string &filename, std::ostream &out) throw(std::exception);
 
+	/**
+	 * Set the number of threads used to copy and relocate segments while
+	 * creating a memory dump. The dump is identical for any thread count.
+	 *
+	 * @param count The number of threads, 1 loads all segments serially.
+	 */
+	void setThreadCount(uint count) { _threadCount = count ? count : 1; }
+
+	/**
+	 * Query the number of threads used for loading.
+	 */
+	uint getThreadCount() const { return _threadCount; }
+
+	/**
+	 * Set how the code segments are placed in the memory dump.
+	 *
+	 * By default the segments are packed in id order. The jump table and the
+	 * relocations always follow the planned layout.
+	 *
+	 * @param layout The layout planner.
+	 */
+	void setSegmentLayout(const SegmentLayout &layout) { _segmentLayout = layout; }
+
+	/**
+	 * Query how the code segments are placed in the memory dump.
+	 */
+	const SegmentLayout &getSegmentLayout() const { return _segmentLayout; }
+
+	/**
+	 * Query where the code segments were placed in the last memory dump, in
+	 * segment id order.
+	 */
+	const std::vector<SegmentPlacement> &getSegmentPlacements() const { return _segmentPlacements; }
+
+	/**
+	 * Set whether memory dumps are written through a mapping of the file.
+	 *
+	 * The file is sized up front and the executable is loaded straight into
+	 * the mapping, instead of into a buffer which is written afterwards.
+	 * Zero filled parts of the dump are never touched.
+	 *
+	 * @param mapped Whether to map the dump file.
+	 */
+	void setMappedOutput(bool mapped) { _mappedOutput = mapped; }
+
+	/**
+	 * Query whether memory dumps are written through a mapping of the file.
+	 */
+	bool getMappedOutput() const { return _mappedOutput; }
+
+	/**
+	 * Write a relocation file for the last memory dump.
+	 *
+	 * It lists every word which depends on the base address, that is all
+	 * relocations and the function addresses of the loaded jump table
+	 * entries. The dump is written for base address 0.
+	 *
+	 * @param filename The file to write to.
+	 * @throws std::exception Errors on writing or no dump was written yet.
+	 */
+	void writeRelocationFile(const std::string &filename) const throw(std::exception);
+
 	/**
 	 * Query the resource fork.
 	 */
@@ -84,6 +168,25 @@ public:
 	 */
 	const Code0Segment &getCode0Segment() const { return *_code0; }
 
+	/**
+	 * Query the jump table ownership index.
+	 *
+	 * It describes the jump table as stored in CODE0, before any segment is
+	 * loaded.
+	 */
+	const JumpTableIndex &getJumpTableIndex() const { return _jumpTableIndex; }
+
+	/**
+	 * Query the relocation tables applied to the memory dump, in the order
+	 * they were applied.
+	 */
+	const std::vector<RelocationTable> &getRelocationTables() const { return _relocationTables; }
+
+	/**
+	 * Add a relocation table applied by a static data loader.
+	 */
+	void addRelocationTable(const RelocationTable &table) { _relocationTables.push_back(table); }
+
 	/**
 	 * Query the memory dump.
 	 */
@@ -95,7 +198,23 @@ public:
 	uint32 getMemorySize() const { return _memorySize; }
 private:
 	/**
-	 * Load the executable into memory.
+	 * Parse the code segments of the loaded resource fork.
+	 *
+	 * @param filename The file name used in error messages.
+	 */
+	void loadSegments(const std::string &filename) throw(std::exception);
+
+	/**
+	 * Plan where the code segments are placed in the memory dump.
+	 *
+	 * @return The size of the memory dump.
+	 */
+	uint32 planLayout() throw(std::exception);
+
+	/**
+	 * Load the executable into the memory.
+	 *
+	 * The memory has to be zeroed and sized as planned by planLayout().
 	 *
 	 * @param out Where to output misc loading information.
 	 */
@@ -122,9 +241,9 @@ private:
 	CodeSegmentMap _codeSegments;
 
 	/**
-	 * The size of all code segments.
+	 * Which segment loads which jump table entries.
 	 */
-	uint32 _codeSegmentsSize;
+	JumpTableIndex _jumpTableIndex;
 
 	/**
 	 * The memory dump.
@@ -136,6 +255,31 @@ private:
 	 */
 	uint32 _memorySize;
 
+	/**
+	 * The relocation tables applied to the memory dump.
+	 */
+	std::vector<RelocationTable> _relocationTables;
+
+	/**
+	 * The number of threads used for loading segments.
+	 */
+	uint _threadCount;
+
+	/**
+	 * How the code segments are placed in the memory dump.
+	 */
+	SegmentLayout _segmentLayout;
+
+	/**
+	 * Where the code segments were placed in the last memory dump.
+	 */
+	std::vector<SegmentPlacement> _segmentPlacements;
+
+	/**
+	 * Whether memory dumps are written through a mapping of the file.
+	 */
+	bool _mappedOutput;
+
 	/**
 	 * The static data loader manager.
 	 */
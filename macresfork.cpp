@@ -19,50 +19,271 @@
  * Partially based on ScummVM's Mac resource fork parser
  */
 
+#include <algorithm>
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "macresfork.h"
+#include "bereader.h"
+#include "binhex.h"
+#include "dcmp.h"
+#include "dircache.h"
+#include "mapcache.h"
 
 ResourceFork::ResourceFork() {
-	_file = 0;
+	_fd = -1;
+	_nameIndexBuilt = false;
+	_fileSize = 0;
+	_fileMTime = 0;
+	_mapping = 0;
+	_mappingSize = 0;
+	_directoryCache = 0;
+	_cacheBudget = kDefaultCacheBudget;
+	_cacheSize = 0;
+	_cacheHits = 0;
+	_cacheMisses = 0;
 }
 
 ResourceFork::~ResourceFork() {
 	close();
 }
 
-bool ResourceFork::load(const char *filename) {
-	if (loadFromMacBaseFilename(filename))
-		return true;
+bool ResourceFork::load(const char *filename, bool mapFile, ResourceForkContainer container) {
+	close();
+
+	if (container == kContainerAuto || container == kContainerNamedFork) {
+		if (loadFromMacBaseFilename(filename, mapFile))
+			return true;
+
+		if (container == kContainerNamedFork)
+			return false;
+	}
 
-	if (loadFromMacBinary(filename))
+	if (loadFile(filename, mapFile, container))
 		return true;
 
-	if (loadFromAppleDouble(filename))
+	if (container == kContainerAuto && loadFromVolume(filename))
 		return true;
 
-	if (loadFromRawFork(filename))
+	// A data fork on its own might have the resource fork stored next to it
+	if (container == kContainerAuto)
+		return loadFromSidecar(filename, mapFile);
+
+	return false;
+}
+
+bool ResourceFork::loadFile(const std::string &filename, bool mapFile, ResourceForkContainer container) {
+	if (!openFile(filename, mapFile))
+		return false;
+
+	// Read the header once and use it to decide which container we have
+	byte header[kSniffSize];
+	uint32 headerSize = readHeader(header, kSniffSize);
+
+	bool detected = (container == kContainerAuto);
+	ResourceForkContainer detectedContainer = detected ? detectContainer(header, headerSize) : container;
+
+	// Reuse a previously parsed map in case the file did not change. BinHex
+	// needs to be decoded anyway, so its maps are not worth caching.
+	MapCache::Key cacheKey;
+	bool useCache = !_cacheDirectory.empty() && detectedContainer != kContainerBinHex;
+
+	if (useCache) {
+		cacheKey = getCacheKey(filename, header, headerSize, container);
+
+		if (MapCache::load(_cacheDirectory, cacheKey, _types, _table)) {
+			buildIndex();
+			return true;
+		}
+	}
+
+	container = detectedContainer;
+	bool loaded = false;
+
+	switch (container) {
+	case kContainerMacBinary:
+		loaded = loadFromMacBinary(header, headerSize);
+		break;
+	case kContainerAppleDouble:
+		loaded = loadFromAppleDouble(header, headerSize);
+		break;
+	case kContainerBinHex:
+		loaded = loadFromBinHex();
+		break;
+	default:
+		loaded = loadInternal(header, headerSize, 0);
+		break;
+	}
+
+	// Something merely looking like a container header might still be a raw fork
+	if (!loaded && detected && container != kContainerRaw)
+		loaded = loadInternal(header, headerSize, 0);
+
+	if (!loaded)
+		close();
+	else if (useCache)
+		MapCache::save(_cacheDirectory, cacheKey, _types, _table);
+
+	return loaded;
+}
+
+void ResourceFork::setCacheDirectory(const std::string &directory) {
+	_cacheDirectory = directory;
+}
+
+void ResourceFork::setDirectoryCache(DirectoryCache *cache) {
+	_directoryCache = cache;
+}
+
+bool ResourceFork::loadFromSidecar(const std::string &filename, bool mapFile) {
+	std::string::size_type separator = filename.rfind('/');
+	std::string directory = (separator == std::string::npos) ? "." : filename.substr(0, std::max<std::string::size_type>(separator, 1));
+	std::string name = (separator == std::string::npos) ? filename : filename.substr(separator + 1);
+
+	if (name.empty())
+		return false;
+
+	// AppleDouble (Mac OS X), netatalk, CAP/UShare and plain .rsrc sidecars
+	const std::string candidates[][2] = {
+		{ directory, "._" + name },
+		{ directory + "/.AppleDouble", name },
+		{ directory, "%" + name },
+		{ directory, name + ".rsrc" }
+	};
+
+	for (uint32 i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+		// Without a directory cache opening the candidate is the check
+		if (_directoryCache && !_directoryCache->exists(candidates[i][0], candidates[i][1]))
+			continue;
+
+		if (loadFile(candidates[i][0] + "/" + candidates[i][1], mapFile, kContainerAuto))
+			return true;
+	}
+
+	return false;
+}
+
+bool ResourceFork::loadFromVolume(const std::string &filename) {
+	// The image is the longest existing file in front of a ':'
+	for (std::string::size_type separator = filename.rfind(':'); separator != std::string::npos && separator > 0; separator = filename.rfind(':', separator - 1)) {
+		struct stat st;
+
+		if (stat(filename.substr(0, separator).c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+
+		HFSVolume volume;
+		HFSFile file;
+
+		return volume.open(filename.substr(0, separator)) && volume.findFile(filename.substr(separator + 1), file) && load(volume, file);
+	}
+
+	return false;
+}
+
+bool ResourceFork::load(HFSVolume &volume, const HFSFile &file) {
+	close();
+
+	std::vector<HFSExtent> extents;
+
+	if (!volume.isOpen() || file.resourceFork.length == 0 || file.resourceFork.length > 0xffffffff || !volume.getForkExtents(file, true, extents))
+		return false;
+
+	// The fork keeps its own descriptor, so it outlives the volume
+	_fd = dup(volume.getFileDescriptor());
+
+	if (_fd == -1)
+		return false;
+
+	_extents.swap(extents);
+	_fileSize = file.resourceFork.length;
+	_fileMTime = volume.getModificationTime();
+
+	byte header[16];
+	uint32 headerSize = readHeader(header, 16);
+
+	if (loadInternal(header, headerSize, 0))
 		return true;
 
+	close();
 	return false;
 }
 
-bool ResourceFork::loadFromRawFork(std::string filename) {
-	_file = fopen(filename.c_str(), "rb");
+MapCache::Key ResourceFork::getCacheKey(const std::string &filename, const byte *header, uint32 headerSize, ResourceForkContainer container) const {
+	MapCache::Key key;
+	char *path = realpath(filename.c_str(), 0);
 
-	if (!_file)
+	key.path = path ? path : filename;
+	key.size = _fileSize;
+	key.mtime = _fileMTime;
+	key.headerHash = MapCache::hashHeader(header, headerSize);
+	key.container = container;
+
+	free(path);
+	return key;
+}
+
+bool ResourceFork::openFile(const std::string &filename, bool mapFile) {
+	_fd = open(filename.c_str(), O_RDONLY);
+
+	if (_fd == -1)
+		return false;
+
+	struct stat st;
+
+	// Offsets in resource forks are 32bit, larger files are no valid forks
+	if (fstat(_fd, &st) != 0 || (uint64)st.st_size > 0xFFFFFFFF) {
+		close();
 		return false;
+	}
+
+	_fileSize = st.st_size;
+	_fileMTime = st.st_mtime;
+
+	// In case mapping fails we silently fall back to regular reads
+	if (mapFile && _fileSize > 0) {
+		void *mapping = mmap(0, _fileSize, PROT_READ, MAP_PRIVATE, _fd, 0);
+
+		if (mapping != MAP_FAILED) {
+			_mapping = (const byte *)mapping;
+			_mappingSize = _fileSize;
+		}
+	}
+
+	return true;
+}
+
+uint32 ResourceFork::readHeader(byte *header, uint32 size) {
+	size = std::min(size, _fileSize);
+
+	if (!readData(0, header, size))
+		return 0;
 
-	return loadInternal();
+	return size;
 }
 
-bool ResourceFork::loadFromMacBaseFilename(std::string filename) {
+bool ResourceFork::loadFromMacBaseFilename(std::string filename, bool mapFile) {
 #ifdef __APPLE__
 	// On Mac OS X, try to access the resource fork directly
-	return loadFromRawFork(filename + "/..namedfork/rsrc");
+	if (!openFile(filename + "/..namedfork/rsrc", mapFile))
+		return false;
+
+	byte header[16];
+	uint32 headerSize = readHeader(header, 16);
+
+	if (loadInternal(header, headerSize, 0))
+		return true;
+
+	close();
 #else
-	return false;
+	(void)filename;
+	(void)mapFile;
 #endif
+	return false;
 }
 
 #define MBI_INFOHDR 128
@@ -74,230 +295,707 @@ bool ResourceFork::loadFromMacBaseFilename(std::string filename) {
 #define MBI_RFLEN 87
 #define MAXNAMELEN 63
 
-bool ResourceFork::loadFromMacBinary(std::string filename) {
-	_file = fopen(filename.c_str(), "rb");
+#define AD_MAGIC 0x00051607
+#define AD_ENTRYCOUNT 24
+#define AD_ENTRIES 26
+#define AD_RSRCFORK 2
+
+ResourceForkContainer ResourceFork::detectContainer(const byte *header, uint32 headerSize) const {
+	if (headerSize >= AD_ENTRIES && READ_UINT32_BE(header) == AD_MAGIC)
+		return kContainerAppleDouble;
+
+	if (headerSize == MBI_INFOHDR && header[MBI_ZERO1] == 0 && header[MBI_ZERO2] == 0 &&
+		header[MBI_ZERO3] == 0 && header[MBI_NAMELEN] <= MAXNAMELEN)
+		return kContainerMacBinary;
 
-	if (!_file)
+	// BinHex files may start with some text, but usually not with much
+	const char *identification = BinHexDecoder::getIdentification();
+
+	if (std::search(header, header + headerSize, identification, identification + strlen(identification)) != header + headerSize)
+		return kContainerBinHex;
+
+	return kContainerRaw;
+}
+
+bool ResourceFork::loadFromMacBinary(const byte *infoHeader, uint32 headerSize) {
+	if (headerSize != MBI_INFOHDR)
+		return false;
+
+	// Pull out the resource fork length
+	uint32 dataSize = READ_UINT32_BE(infoHeader + MBI_DFLEN);
+	uint32 rsrcSize = READ_UINT32_BE(infoHeader + MBI_RFLEN);
+
+	uint32 dataSizePad = (((dataSize + 127) >> 7) << 7);
+	uint32 rsrcSizePad = (((rsrcSize + 127) >> 7) << 7);
+
+	// Length check
+	if (MBI_INFOHDR + dataSizePad + rsrcSizePad != _fileSize)
 		return false;
 
-	byte infoHeader[MBI_INFOHDR];
-	fread(infoHeader, 1, MBI_INFOHDR, _file);
+	return loadInternal(0, 0, MBI_INFOHDR + dataSizePad);
+}
 
-	// Try to parse the MacBinary header
-	if (infoHeader[MBI_ZERO1] == 0 && infoHeader[MBI_ZERO2] == 0 &&
-		infoHeader[MBI_ZERO3] == 0 && infoHeader[MBI_NAMELEN] <= MAXNAMELEN) {
+bool ResourceFork::loadFromAppleDouble(const byte *header, uint32 headerSize) {
+	if (headerSize < AD_ENTRIES || READ_UINT32_BE(header) != AD_MAGIC)
+		return false;
 
-		// Pull out the resource fork length
-		uint32 dataSize = READ_UINT32_BE(infoHeader + MBI_DFLEN);
-		uint32 rsrcSize = READ_UINT32_BE(infoHeader + MBI_RFLEN);
+	uint16 entryCount = READ_UINT16_BE(header + AD_ENTRYCOUNT);
 
-		uint32 dataSizePad = (((dataSize + 127) >> 7) << 7);
-		uint32 rsrcSizePad = (((rsrcSize + 127) >> 7) << 7);
+	// The entry table usually fits into the sniffed header, otherwise read it
+	std::vector<byte> entryBuffer;
+	const byte *entries = header + AD_ENTRIES;
 
-		// Length check
-		if (MBI_INFOHDR + dataSizePad + rsrcSizePad == getFileSize(_file))
-			return loadInternal(MBI_INFOHDR + dataSizePad);
+	if (AD_ENTRIES + entryCount * 12u > headerSize) {
+		entryBuffer.resize(entryCount * 12);
+
+		if (!readData(AD_ENTRIES, &entryBuffer[0], entryBuffer.size()))
+			return false;
+
+		entries = &entryBuffer[0];
+	}
+
+	for (uint16 i = 0; i < entryCount; i++) {
+		uint32 id = READ_UINT32_BE(entries + i * 12);
+		uint32 offset = READ_UINT32_BE(entries + i * 12 + 4);
+
+		if (id == AD_RSRCFORK) // Found the resource fork!
+			return loadInternal(0, 0, offset);
 	}
 
-	close();
 	return false;
 }
 
-bool ResourceFork::loadFromAppleDouble(std::string filename) {
-	_file = fopen(filename.c_str(), "rb");
+bool ResourceFork::loadFromBinHex() {
+	BinHexDecoder decoder;
 
-	if (!_file)
-		return false;
+	// Feed the text to the decoder as it is read, the resource fork is the
+	// only thing kept
+	if (_mapping) {
+		if (!decoder.decode(_mapping, _mappingSize))
+			return false;
+	} else {
+		byte buffer[64 * 1024];
 
-	if (readUint32BE(_file) != 0x00051607) { // tag
-		close();
+		for (uint32 offset = 0; offset < _fileSize && !decoder.isFinished(); offset += sizeof(buffer)) {
+			uint32 size = std::min<uint32>(sizeof(buffer), _fileSize - offset);
+
+			if (!readData(offset, buffer, size) || !decoder.decode(buffer, size))
+				return false;
+		}
+	}
+
+	if (!decoder.isFinished() || decoder.getResourceFork().empty())
 		return false;
+
+	// From here on all reads are served from the decoded fork
+	if (_mapping)
+		munmap((void *)_mapping, _mappingSize);
+
+	_decodedFork.swap(decoder.getResourceFork());
+	_mapping = &_decodedFork[0];
+	_mappingSize = _fileSize = _decodedFork.size();
+
+	return loadInternal(0, 0, 0);
+}
+
+bool ResourceFork::readData(uint32 offset, byte *buffer, uint32 size) {
+	if (_mapping) {
+		if (offset > _mappingSize || size > _mappingSize - offset)
+			return false;
+
+		std::memcpy(buffer, _mapping + offset, size);
+		return true;
 	}
 
-	fseek(_file, 20, SEEK_CUR); // version + home file system
+	if (_extents.empty())
+		return readFileData(offset, buffer, size);
 
-	uint16 entryCount = readUint16BE(_file);
+	// A fork inside a disk image, find the extents covering the range
+	uint64 position = 0;
 
-	for (uint16 i = 0; i < entryCount; i++) {
-		uint32 id = readUint32BE(_file);
-		uint32 offset = readUint32BE(_file);
-		/* uint32 length = */ readUint32BE(_file);
+	for (uint32 i = 0; i < _extents.size() && size > 0; i++) {
+		if (offset < position + _extents[i].length) {
+			uint32 chunk = std::min<uint64>(size, position + _extents[i].length - offset);
+
+			if (!readFileData(_extents[i].offset + (offset - position), buffer, chunk))
+				return false;
+
+			buffer += chunk;
+			offset += chunk;
+			size -= chunk;
+		}
 
-		if (id == 2) // Found the resource fork!
-			return loadInternal(offset);
+		position += _extents[i].length;
 	}
 
-	close();
-	return false;
+	return size == 0;
 }
 
-bool ResourceFork::loadInternal(uint32 startOffset) {
-	fseek(_file, startOffset, SEEK_SET);
+bool ResourceFork::readFileData(uint64 offset, byte *buffer, uint32 size) {
+	// Positional reads leave no shared file position behind, so several
+	// threads may read from the fork at once
+	while (size > 0) {
+		ssize_t count = pread(_fd, buffer, size, offset);
 
-	uint32 fileSize = getFileSize(_file);
-	uint32 dataOffset = readUint32BE(_file) + startOffset;
-	uint32 mapOffset = readUint32BE(_file) + startOffset;
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			return false;
 
-	if (feof(_file) || dataOffset == 0 || mapOffset == 0 || dataOffset >= fileSize || mapOffset >= fileSize) {
-		close();
-		return false;
+		buffer += count;
+		offset += count;
+		size -= count;
 	}
 
-	fseek(_file, mapOffset + 24, SEEK_SET);
+	return true;
+}
 
-	uint16 typeOffset = readUint16BE(_file);
-	uint16 nameOffset = readUint16BE(_file);
-	uint16 typeCount = readUint16BE(_file) + 1;
+bool ResourceFork::loadInternal(const byte *header, uint32 headerSize, uint32 startOffset) {
+	byte forkHeader[sizeof(ResourceForkHeader)];
 
-	if (feof(_file) || typeOffset == 0 || typeOffset >= fileSize) {
-		close();
+	// Reuse the already read header where possible
+	if (startOffset == 0 && headerSize >= sizeof(forkHeader))
+		std::memcpy(forkHeader, header, sizeof(forkHeader));
+	else if (!readData(startOffset, forkHeader, sizeof(forkHeader)))
 		return false;
+
+	uint32 fileSize = _fileSize;
+	const ResourceForkHeader *fork = BigEndianReader(forkHeader, sizeof(forkHeader)).overlay<ResourceForkHeader>(0);
+
+	uint32 dataOffset = fork->dataOffset + startOffset;
+	uint32 mapOffset = fork->mapOffset + startOffset;
+	uint32 mapLength = fork->mapLength;
+
+	if (dataOffset == 0 || mapOffset == 0 || dataOffset >= fileSize || mapOffset >= fileSize || mapLength < sizeof(ResourceMapHeader) || mapLength > fileSize - mapOffset)
+		return false;
+
+	// Get the whole resource map at once and decode it from memory
+	std::vector<byte> mapBuffer;
+	const byte *mapData = _mapping + mapOffset;
+
+	if (!_mapping) {
+		mapBuffer.resize(mapLength);
+
+		if (!readData(mapOffset, &mapBuffer[0], mapLength))
+			return false;
+
+		mapData = &mapBuffer[0];
 	}
 
-	_types.resize(typeCount);
+	BigEndianReader map(mapData, mapLength);
+	const ResourceMapHeader *mapHeader = map.overlay<ResourceMapHeader>(0);
 
-	for (uint16 i = 0; i < typeCount; i++) {
-		_types[i].tag = readUint32BE(_file);
-		uint16 idCount = readUint16BE(_file) + 1;
-		uint16 idOffset = readUint16BE(_file);
+	uint16 typeOffset = mapHeader->typeListOffset;
+	uint16 nameOffset = mapHeader->nameListOffset;
+	uint16 typeCount = mapHeader->typeCount + 1;
+
+	if (typeOffset == 0 || typeOffset >= mapLength || !map.fits(sizeof(ResourceMapHeader), typeCount * sizeof(ResourceTypeEntry)))
+		return false;
 
-		uint32 lastTypePos = ftell(_file);
+	const ResourceTypeEntry *types = map.overlay<ResourceTypeEntry>(sizeof(ResourceMapHeader));
+	_types.resize(typeCount);
 
-		fseek(_file, idOffset + mapOffset + typeOffset, SEEK_SET);
+	uint32 resourceCount = 0;
 
-		for (uint16 j = 0; j < idCount; j++) {
-			ResourceForkID id;
+	for (uint16 i = 0; i < typeCount; i++) {
+		_types[i].tag = types[i].tag;
+		_types[i].first = resourceCount;
+		_types[i].count = types[i].count + 1;
 
-			id.id = readUint16BE(_file);
-			uint16 idNameOffset = readUint16BE(_file);
-			id.offset = (readUint32BE(_file) & 0xffffff) + dataOffset;
-			readUint32BE(_file);
+		if (!map.fits(types[i].refListOffset + typeOffset, _types[i].count * sizeof(ResourceRefEntry)))
+			return false;
 
-			if (nameOffset != 0xffff) {
-				uint32 lastIDPos = ftell(_file);
+		resourceCount += _types[i].count;
+	}
 
-				fseek(_file, nameOffset + mapOffset + idNameOffset, SEEK_SET);
+	_table.ids.resize(resourceCount);
+	_table.offsets.resize(resourceCount);
+	_table.nameOffsets.resize(resourceCount);
 
-				byte stringLength = readByte(_file);
-				char *subFilename = new char[stringLength + 1];
-				subFilename[stringLength] = 0;
-				fread(subFilename, 1, stringLength, _file);
-	
-				id.filename = subFilename;
-				delete[] subFilename;
+	// The name list runs up to the end of the map. Names are decoded from it
+	// when they are needed.
+	if (nameOffset != 0xffff && nameOffset < mapLength)
+		_table.nameList.assign(mapData + nameOffset, mapData + mapLength);
 
-				if (j != idCount - 1)
-					fseek(_file, lastIDPos, SEEK_SET);
+	for (uint16 i = 0; i < typeCount; i++) {
+		const ResourceRefEntry *ref = map.overlay<ResourceRefEntry>(types[i].refListOffset + typeOffset);
 
-				//printf("%c%c%c%c %04x - %s\n", _types[i].tag >> 24, (_types[i].tag >> 16) & 0xff, (_types[i].tag >> 8) & 0xff, _types[i].tag & 0xff, id.id, id.filename.c_str());
-			} /*else
-				printf("%c%c%c%c %04x\n", _types[i].tag >> 24, (_types[i].tag >> 16) & 0xff, (_types[i].tag >> 8) & 0xff, _types[i].tag & 0xff, id.id); */
+		for (uint32 j = _types[i].first; j < _types[i].first + _types[i].count; j++, ref++) {
+			uint16 idNameOffset = ref->nameOffset;
 
-			_types[i].ids.push_back(id);
+			_table.ids[j] = ref->id;
+			_table.offsets[j] = (ref->attributesAndOffset & 0xffffff) + dataOffset;
+			_table.nameOffsets[j] = (idNameOffset == 0xffff) ? ResourceTable::kNoName : idNameOffset;
 		}
+	}
 
-		if (i != typeCount - 1)
-			fseek(_file, lastTypePos, SEEK_SET);
+	buildIndex();
+	return true;
+}
+
+// Case folding table for MacRoman encoded resource names
+static const byte kMacRomanCaseFold[256] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F,
+	0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0x3E, 0x3F,
+	0x40, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F,
+	0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x5B, 0x5C, 0x5D, 0x5E, 0x5F,
+	0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6A, 0x6B, 0x6C, 0x6D, 0x6E, 0x6F,
+	0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x7B, 0x7C, 0x7D, 0x7E, 0x7F,
+	0x8A, 0x8C, 0x8D, 0x8E, 0x96, 0x9A, 0x9F, 0x87, 0x88, 0x89, 0x8A, 0x8B, 0x8C, 0x8D, 0x8E, 0x8F,
+	0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0x9B, 0x9C, 0x9D, 0x9E, 0x9F,
+	0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xAB, 0xAC, 0xAD, 0xBE, 0xBF,
+	0xB0, 0xB1, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xBB, 0xBC, 0xBD, 0xBE, 0xBF,
+	0xC0, 0xC1, 0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0x88, 0x8B, 0x9B, 0xCF, 0xCF,
+	0xD0, 0xD1, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD8, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE, 0xDF,
+	0xE0, 0xE1, 0xE2, 0xE3, 0xE4, 0x89, 0x90, 0x87, 0x91, 0x8F, 0x92, 0x94, 0x95, 0x93, 0x97, 0x99,
+	0xF0, 0x98, 0x9C, 0x9E, 0x9D, 0xF5, 0xF6, 0xF7, 0xF8, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF
+};
+
+uint32 ResourceFork::hashName(const byte *name, uint32 length) {
+	// FNV-1a over the case folded name
+	uint32 hash = 2166136261u;
+
+	for (uint32 i = 0; i < length; i++) {
+		hash ^= kMacRomanCaseFold[name[i]];
+		hash *= 16777619u;
 	}
 
+	return hash;
+}
+
+bool ResourceFork::compareNames(const DataView &name1, const std::string &name2) {
+	if (name1.length != name2.size())
+		return false;
+
+	for (uint32 i = 0; i < name2.size(); i++)
+		if (kMacRomanCaseFold[name1.data[i]] != kMacRomanCaseFold[(byte)name2[i]])
+			return false;
+
 	return true;
 }
 
+DataView ResourceTable::getName(uint32 index) const {
+	const uint32 offset = nameOffsets[index];
+
+	// Names outside of the map and empty names are treated as missing
+	if (offset >= nameList.size() || nameList[offset] == 0 || nameList[offset] > nameList.size() - offset - 1)
+		return DataView();
+
+	return DataView(&nameList[offset + 1], nameList[offset]);
+}
+
+void ResourceTable::clear() {
+	ids.clear();
+	offsets.clear();
+	nameOffsets.clear();
+	nameList.clear();
+}
+
+void ResourceFork::buildIndex() {
+	_index.clear();
+	_index.reserve(_table.size());
+
+	for (uint32 i = 0; i < _types.size(); i++)
+		for (uint32 j = _types[i].first; j < _types[i].first + _types[i].count; j++)
+			_index.push_back(ResourceIndexEntry(_types[i].tag, _table.ids[j], j));
+
+	// Entries with equal tag and id stay in file order, so the first match
+	// is the same one a linear scan would find
+	std::sort(_index.begin(), _index.end());
+
+	_nameIndex.clear();
+	_nameIndexBuilt = false;
+}
+
+void ResourceFork::buildNameIndex() const {
+	boost::lock_guard<boost::mutex> lock(_nameIndexMutex);
+
+	if (_nameIndexBuilt)
+		return;
+
+	for (uint32 i = 0; i < _index.size(); i++) {
+		const DataView name = _table.getName(_index[i].index);
+
+		if (name.data)
+			_nameIndex.insert(NameIndex::value_type(hashName(name.data, name.length), i));
+	}
+
+	_nameIndexBuilt = true;
+}
+
+const ResourceIndexEntry *ResourceFork::findResource(uint32 tag, uint16 id) const {
+	IndexIterator it = std::lower_bound(_index.begin(), _index.end(), ResourceIndexEntry(tag, id, 0));
+
+	if (it == _index.end() || it->tag != tag || it->id != id)
+		return 0;
+
+	return &*it;
+}
+
+const ResourceIndexEntry *ResourceFork::findResource(uint32 tag, const std::string &filename, bool matchTag) const {
+	buildNameIndex();
+
+	std::pair<NameIndex::const_iterator, NameIndex::const_iterator> range = _nameIndex.equal_range(hashName((const byte *)filename.c_str(), filename.size()));
+	const ResourceIndexEntry *found = 0;
+
+	// Pick the first match in file order
+	for (NameIndex::const_iterator it = range.first; it != range.second; it++) {
+		const ResourceIndexEntry &entry = _index[it->second];
+
+		if ((matchTag && entry.tag != tag) || (found && found->index < entry.index))
+			continue;
+
+		if (compareNames(_table.getName(entry.index), filename))
+			found = &entry;
+	}
+
+	return found;
+}
+
 void ResourceFork::close() {
-	if (_file) {
-		fclose(_file);
-		_file = 0;
+	if (_mapping) {
+		if (_decodedFork.empty())
+			munmap((void *)_mapping, _mappingSize);
+
+		_mapping = 0;
+		_mappingSize = 0;
 	}
 
+	std::vector<byte>().swap(_decodedFork);
+	_extents.clear();
+
+	_viewBuffers.clear();
+	trimCache(0);
+	_cacheHits = 0;
+	_cacheMisses = 0;
+
+	if (_fd != -1) {
+		::close(_fd);
+		_fd = -1;
+	}
+
+	_fileSize = 0;
+	_fileMTime = 0;
+
 	_types.clear();
+	_table.clear();
+	_index.clear();
+	_nameIndex.clear();
+	_nameIndexBuilt = false;
 }
 
 bool ResourceFork::isOpen() const { 
-	return _file != 0;
+	return _fd != -1;
 }
 
-DataPair *ResourceFork::getResource(uint32 tag, uint16 id) {
-	for (uint32 i = 0; i < _types.size(); i++) {
-		if (_types[i].tag != tag)
-			continue;
+bool ResourceFork::isMapped() const {
+	return _mapping != 0;
+}
 
-		for (uint32 j = 0; j < _types[i].ids.size(); j++) {
-			if (_types[i].ids[j].id != id)
-				continue;
+bool ResourceFork::getDataLength(uint32 offset, uint32 &length) {
+	byte buffer[4];
 
-			fseek(_file, _types[i].ids[j].offset, SEEK_SET);
-			uint32 length = readUint32BE(_file);
-			byte *data = new byte[length];
-			fread(data, 1, length, _file);
-			return new DataPair(data, length);
-		}
+	if (offset > _fileSize || _fileSize - offset < 4 || !readData(offset, buffer, 4))
+		return false;
+
+	length = READ_UINT32_BE(buffer);
+	return length <= _fileSize - offset - 4;
+}
+
+DataView ResourceFork::getMappedData(uint32 offset) {
+	uint32 length;
+
+	if (!getDataLength(offset, length))
+		return DataView();
+
+	return DataView(_mapping + offset + 4, length);
+}
+
+DataPair *ResourceFork::readResource(uint32 offset) {
+	// Compressed resources are decompressed straight from the file data
+	if (_mapping) {
+		DataView view = getMappedData(offset);
+
+		if (!view.data)
+			return 0;
+
+		if (Dcmp::isCompressed(view.data, view.length))
+			return Dcmp::decompress(view);
+
+		return new DataPair(view);
+	}
+
+	uint32 length;
+
+	if (!getDataLength(offset, length))
+		return 0;
+
+	byte *data = new byte[length];
+
+	if (!readData(offset + 4, data, length)) {
+		delete[] data;
+		return 0;
 	}
 
-	return 0;
+	if (Dcmp::isCompressed(data, length)) {
+		DataPair *decompressed = Dcmp::decompress(DataView(data, length));
+		delete[] data;
+		return decompressed;
+	}
+
+	return new DataPair(data, length);
 }
 
-// A very simple function to compare strings while ignoring case
-static int compareStringIgnoreCase(const char *s1, const char *s2) {
-    for(; tolower((byte)(*s1)) == tolower((byte)(*s2)); ++s1, ++s2)
-        if (*s1 == 0 || *s2 == 0)
-            return 0;
+bool ResourceFork::isCompressed(uint32 offset, uint32 length) {
+	byte header[Dcmp::kHeaderSize];
+
+	if (length < Dcmp::kHeaderSize || !readData(offset + 4, header, Dcmp::kHeaderSize))
+		return false;
 
-	return tolower((byte)(*s1)) - tolower((byte)(*s2));
+	return Dcmp::isCompressed(header, Dcmp::kHeaderSize);
 }
 
-DataPair *ResourceFork::getResource(const std::string &filename) {
-	for (uint32 i = 0; i < _types.size(); i++) {
-		for (uint32 j = 0; j < _types[i].ids.size(); j++) {
-			if (compareStringIgnoreCase(_types[i].ids[j].filename.c_str(), filename.c_str()))
-				continue;
-
-			fseek(_file, _types[i].ids[j].offset, SEEK_SET);
-			uint32 length = readUint32BE(_file);
-			byte *data = new byte[length];
-			fread(data, 1, length, _file);
-			return new DataPair(data, length);
+boost::shared_ptr<const DataPair> ResourceFork::readCachedResource(uint32 offset) {
+	{
+		boost::lock_guard<boost::mutex> lock(_cacheMutex);
+		boost::unordered_map<uint32, CacheList::iterator>::iterator cached = _cacheIndex.find(offset);
+
+		if (cached != _cacheIndex.end()) {
+			_cacheHits++;
+			_cache.splice(_cache.begin(), _cache, cached->second);
+			return cached->second->second;
 		}
+
+		_cacheMisses++;
 	}
 
-	return 0;
+	// Read and decompress without holding the lock, so other resources can
+	// be read at the same time
+	boost::shared_ptr<const DataPair> data(readResource(offset));
+
+	if (!data)
+		return data;
+
+	boost::lock_guard<boost::mutex> lock(_cacheMutex);
+
+	// Another thread might have read the resource meanwhile
+	boost::unordered_map<uint32, CacheList::iterator>::iterator cached = _cacheIndex.find(offset);
+
+	if (cached != _cacheIndex.end()) {
+		_cache.splice(_cache.begin(), _cache, cached->second);
+		return cached->second->second;
+	}
+
+	// Resources exceeding the whole budget are not worth evicting everything
+	if (data->length > _cacheBudget)
+		return data;
+
+	trimCache(_cacheBudget - data->length);
+	_cache.push_front(std::make_pair(offset, data));
+	_cacheIndex[offset] = _cache.begin();
+	_cacheSize += data->length;
+	return data;
 }
 
-DataPair *ResourceFork::getResource(uint32 tag, const std::string &filename) {
-	for (uint32 i = 0; i < _types.size(); i++) {
-		if (_types[i].tag != tag)
-			continue;
+void ResourceFork::trimCache(uint32 budget) {
+	while (_cacheSize > budget) {
+		_cacheSize -= _cache.back().second->length;
+		_cacheIndex.erase(_cache.back().first);
+		_cache.pop_back();
+	}
+}
 
-		for (uint32 j = 0; j < _types[i].ids.size(); j++) {
-			if (compareStringIgnoreCase(_types[i].ids[j].filename.c_str(), filename.c_str()))
-				continue;
+void ResourceFork::setCacheBudget(uint32 bytes) {
+	boost::lock_guard<boost::mutex> lock(_cacheMutex);
+	_cacheBudget = bytes;
+	trimCache(bytes);
+}
 
-			fseek(_file, _types[i].ids[j].offset, SEEK_SET);
-			uint32 length = readUint32BE(_file);
-			byte *data = new byte[length];
-			fread(data, 1, length, _file);
-			return new DataPair(data, length);
-		}
+uint32 ResourceFork::getCacheBudget() const {
+	boost::lock_guard<boost::mutex> lock(_cacheMutex);
+	return _cacheBudget;
+}
+
+uint32 ResourceFork::getCacheSize() const {
+	boost::lock_guard<boost::mutex> lock(_cacheMutex);
+	return _cacheSize;
+}
+
+uint32 ResourceFork::getCacheHits() const {
+	boost::lock_guard<boost::mutex> lock(_cacheMutex);
+	return _cacheHits;
+}
+
+uint32 ResourceFork::getCacheMisses() const {
+	boost::lock_guard<boost::mutex> lock(_cacheMutex);
+	return _cacheMisses;
+}
+
+uint32 ResourceFork::readResource(uint32 tag, uint16 id, uint32 offset, byte *buffer, uint32 size) {
+	ResourceReader reader = openResource(tag, id);
+
+	if (!reader.isValid())
+		return 0;
+
+	return reader.readAt(offset, buffer, size);
+}
+
+bool ResourceFork::readResourceStart(uint32 tag, uint16 id, byte *buffer, uint32 &size, uint32 &length) {
+	const ResourceIndexEntry *res = findResource(tag, id);
+
+	if (!res || !getDataLength(_table.offsets[res->index], length))
+		return false;
+
+	const uint32 offset = _table.offsets[res->index];
+
+	if (!isCompressed(offset, length)) {
+		size = std::min(size, length);
+		return readData(offset + 4, buffer, size);
 	}
 
-	return 0;
+	// The compressed data is needed as a whole, but only its start is decoded
+	if (_mapping)
+		return Dcmp::decompressStart(getMappedData(offset), buffer, size, length);
+
+	std::vector<byte> data(length);
+
+	if (!readData(offset + 4, &data[0], length))
+		return false;
+
+	return Dcmp::decompressStart(DataView(&data[0], length), buffer, size, length);
 }
 
-const char *ResourceFork::getFilename(uint32 tag, uint16 id) {
-	for (uint32 i = 0; i < _types.size(); i++) {
-		if (_types[i].tag != tag)
-			continue;
+ResourceReader ResourceFork::openResource(uint32 tag, uint16 id) {
+	const ResourceIndexEntry *res = findResource(tag, id);
+	uint32 length;
 
-		for (uint32 j = 0; j < _types[i].ids.size(); j++) {
-			if (_types[i].ids[j].id != id)
-				continue;
+	if (!res || !getDataLength(_table.offsets[res->index], length))
+		return ResourceReader();
 
-			if (!_types[i].ids[j].filename.empty())
-				return _types[i].ids[j].filename.c_str();
-		}
+	// Compressed resources can only be read as a whole
+	if (isCompressed(_table.offsets[res->index], length)) {
+		boost::shared_ptr<const DataPair> data = readCachedResource(_table.offsets[res->index]);
+
+		if (!data)
+			return ResourceReader();
+
+		return ResourceReader(data);
 	}
 
-	static char filename[12];
-	sprintf(filename, "%c%c%c%c_%02d.dat", tag >> 24, (tag >> 16) & 0xff, (tag >> 8) & 0xff, tag & 0xff, id);
+	return ResourceReader(this, _table.offsets[res->index] + 4, length);
+}
+
+uint32 ResourceReader::read(byte *buffer, uint32 size) {
+	uint32 count = readAt(_pos, buffer, size);
+	_pos += count;
+	return count;
+}
+
+uint32 ResourceReader::readAt(uint32 offset, byte *buffer, uint32 size) {
+	if (!isValid() || offset >= _size)
+		return 0;
+
+	size = std::min(size, _size - offset);
+
+	if (_data)
+		std::memcpy(buffer, _data->data + offset, size);
+	else if (!_fork->readData(_start + offset, buffer, size))
+		return 0;
+
+	return size;
+}
+
+bool ResourceReader::seek(uint32 pos) {
+	if (pos > _size)
+		return false;
+
+	_pos = pos;
+	return true;
+}
+
+DataPair *ResourceFork::getResource(uint32 tag, uint16 id) {
+	return copyResource(findResource(tag, id));
+}
+
+boost::shared_ptr<const DataPair> ResourceFork::getSharedResource(uint32 tag, uint16 id) {
+	const ResourceIndexEntry *res = findResource(tag, id);
+
+	if (!res)
+		return boost::shared_ptr<const DataPair>();
+
+	return readCachedResource(_table.offsets[res->index]);
+}
+
+DataView ResourceFork::getResourceView(uint32 tag, uint16 id) {
+	const ResourceIndexEntry *res = findResource(tag, id);
+
+	if (!res)
+		return DataView();
+
+	if (_mapping) {
+		DataView view = getMappedData(_table.offsets[res->index]);
+
+		if (!view.data || !Dcmp::isCompressed(view.data, view.length))
+			return view;
+	}
+
+	// Without a mapping, or for compressed resources, the data is kept around
+	// until the fork is closed. Every resource is kept only once.
+	const uint32 offset = _table.offsets[res->index];
+
+	{
+		boost::lock_guard<boost::mutex> lock(_viewBuffersMutex);
+		ViewBufferMap::const_iterator buffer = _viewBuffers.find(offset);
+
+		if (buffer != _viewBuffers.end())
+			return *buffer->second;
+	}
+
+	boost::shared_ptr<const DataPair> data = readCachedResource(offset);
+
+	if (!data)
+		return DataView();
+
+	boost::lock_guard<boost::mutex> lock(_viewBuffersMutex);
+	return *_viewBuffers.insert(std::make_pair(offset, data)).first->second;
+}
+
+DataPair *ResourceFork::getResource(const std::string &filename) {
+	return copyResource(findResource(0, filename, false));
+}
+
+DataPair *ResourceFork::getResource(uint32 tag, const std::string &filename) {
+	return copyResource(findResource(tag, filename, true));
+}
+
+DataPair *ResourceFork::copyResource(const ResourceIndexEntry *res) {
+	if (!res)
+		return 0;
+
+	// Mapped data is already in memory, so there is nothing to cache
+	if (_mapping)
+		return readResource(_table.offsets[res->index]);
+
+	boost::shared_ptr<const DataPair> data = readCachedResource(_table.offsets[res->index]);
+
+	if (!data)
+		return 0;
+
+	return new DataPair(*data);
+}
+
+std::string ResourceFork::getFilename(uint32 tag, uint16 id) const {
+	const ResourceIndexEntry *res = findResource(tag, id);
+
+	const DataView name = res ? _table.getName(res->index) : DataView();
+
+	if (name.data)
+		return std::string((const char *)name.data, name.length);
+
+	char filename[16];
+	snprintf(filename, sizeof(filename), "%c%c%c%c_%02d.dat", tag >> 24, (tag >> 16) & 0xff, (tag >> 8) & 0xff, tag & 0xff, id);
 
 	return filename;
 }
@@ -321,13 +1019,18 @@ std::vector<uint16> ResourceFork::getIDArray(uint32 tag) {
 
 	for (uint32 i = 0; i < _types.size(); i++)
 		if (_types[i].tag == tag) {
-			idArray.resize(_types[i].ids.size());
-
-			for (uint32 j = 0; j < _types[i].ids.size(); j++)
-				idArray[j] = _types[i].ids[j].id;
+			const uint32 first = _types[i].first;
 
+			idArray.assign(_table.ids.begin() + first, _table.ids.begin() + first + _types[i].count);
 			return idArray;
 		}
 
 	return idArray;
 }
+
+ResourceFork::IndexRange ResourceFork::getIDRange(uint32 tag) const {
+	IndexIterator begin = std::lower_bound(_index.begin(), _index.end(), ResourceIndexEntry(tag, 0, 0));
+	IndexIterator end = std::upper_bound(begin, _index.end(), ResourceIndexEntry(tag, 0xffff, 0xffffffff));
+
+	return IndexRange(begin, end);
+}
@@ -24,23 +24,68 @@
 
 #include <string>
 #include <vector>
+#include <list>
+#include <utility>
 #include <cstring>
+#include <boost/unordered_map.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include "hfs.h"
 #include "util.h"
 
-struct ResourceForkID {
-	ResourceForkID() { id = 0; }
+// A resource type, referencing a contiguous range of the resource table
+struct ResourceForkType {
+	ResourceForkType() { tag = 0; first = 0; count = 0; }
+	ResourceForkType(uint32 t) { tag = t; first = 0; count = 0; }
 
-	uint16 id;
-	std::string filename;
-	uint32 offset;
+	uint32 tag;
+	uint32 first; // Index of the first resource of the type
+	uint32 count; // Number of resources of the type
 };
 
-struct ResourceForkType {
-	ResourceForkType() { tag = 0; }
-	ResourceForkType(uint32 t) { tag = t; }
+// A non-owning view of resource data, valid as long as the fork stays open
+struct DataView {
+	DataView() { data = 0; length = 0; }
+	DataView(const byte *d, uint32 l) { data = d; length = l; }
+
+	const byte *data;
+	uint32 length;
+};
+
+// Flat resource table. All per resource data is kept in parallel arrays. The
+// raw name list of the map is kept as is and a name is only decoded when
+// it is asked for.
+struct ResourceTable {
+	static const uint32 kNoName = 0xffffffff;
+
+	uint32 size() const { return ids.size(); }
+	// The name of a resource, a null view in case it has none
+	DataView getName(uint32 index) const;
+	void clear();
+
+	std::vector<uint16> ids;
+	std::vector<uint32> offsets;     // Offset of the resource data in the file
+	std::vector<uint32> nameOffsets; // Offset into the name list or kNoName
+	std::vector<byte> nameList;      // Pascal strings as stored in the map
+};
+
+// Entry of the (tag, id) sorted resource index
+struct ResourceIndexEntry {
+	ResourceIndexEntry() { tag = 0; id = 0; index = 0; }
+	ResourceIndexEntry(uint32 t, uint16 i, uint32 n) { tag = t; id = i; index = n; }
+
+	bool operator<(const ResourceIndexEntry &e) const {
+		if (tag != e.tag)
+			return tag < e.tag;
+		if (id != e.id)
+			return id < e.id;
+		return index < e.index;
+	}
 
 	uint32 tag;
-	std::vector<ResourceForkID> ids;
+	uint16 id;
+	uint32 index; // Index into the resource table
 };
 
 struct DataPair {
@@ -48,40 +93,214 @@ struct DataPair {
 	DataPair(const DataPair &d) : data(new byte[d.length]), length(d.length) {
 		std::memcpy(data, d.data, d.length);
 	}
+	explicit DataPair(const DataView &d) : data(new byte[d.length]), length(d.length) {
+		std::memcpy(data, d.data, d.length);
+	}
 	~DataPair() { delete[] data; }
 
+	operator DataView() const { return DataView(data, length); }
+
 	byte *data;
 	uint32 length;
 };
 
+class ResourceFork;
+class DirectoryCache;
+
+namespace MapCache {
+struct Key;
+}
+
+// Reads a single resource incrementally, either as a sequence of chunks or
+// as arbitrary sub-ranges, without loading the whole resource into memory.
+// Compressed resources are decompressed as a whole when opened. It must not
+// outlive the fork it was opened from.
+class ResourceReader {
+public:
+	ResourceReader() { _fork = 0; _start = 0; _size = 0; _pos = 0; }
+
+	bool isValid() const { return _fork != 0 || _data; }
+	uint32 size() const { return _size; }
+	uint32 pos() const { return _pos; }
+	bool eos() const { return _pos >= _size; }
+
+	// Read the next chunk of at most size bytes and return the bytes read
+	uint32 read(byte *buffer, uint32 size);
+	// Read at most size bytes from the given offset into the resource
+	uint32 readAt(uint32 offset, byte *buffer, uint32 size);
+	bool seek(uint32 pos);
+
+private:
+	friend class ResourceFork;
+
+	ResourceReader(ResourceFork *fork, uint32 start, uint32 size) { _fork = fork; _start = start; _size = size; _pos = 0; }
+	ResourceReader(const boost::shared_ptr<const DataPair> &data) : _data(data) { _fork = 0; _start = 0; _size = data->length; _pos = 0; }
+
+	ResourceFork *_fork;
+	boost::shared_ptr<const DataPair> _data; // Decompressed data of compressed resources
+	uint32 _start; // Offset of the resource data in the file
+	uint32 _size;
+	uint32 _pos;
+};
+
+enum ResourceForkContainer {
+	kContainerAuto,       // Detect the container from the file header
+	kContainerNamedFork,  // The native resource fork on Mac OS X
+	kContainerRaw,
+	kContainerMacBinary,
+	kContainerAppleDouble,
+	kContainerBinHex
+};
+
+// Once a fork is loaded its resources may be read from several threads at
+// the same time. Loading and closing must not overlap with any reads.
 class ResourceFork {
 public:
 	ResourceFork();
 	~ResourceFork();
 
-	bool load(const char *filename);
+	// When mapFile is set the whole file is mapped into memory and resource
+	// views point directly into the mapping. The container is detected from
+	// the file header unless a specific one is requested. In case the file
+	// contains no resource fork and the container is detected, sidecar files
+	// (._name, .AppleDouble/name, %name and name.rsrc) are tried as well.
+	// A file inside an HFS disk image is named "image:Folder:File".
+	bool load(const char *filename, bool mapFile = false, ResourceForkContainer container = kContainerAuto);
+	// Load the resource fork of a file inside a disk image. The fork is read
+	// through its extents, it is never mapped. The volume may be closed
+	// afterwards.
+	bool load(HFSVolume &volume, const HFSFile &file);
 	void close();
 	bool isOpen() const;
 
+	// Parsed resource maps are cached in the given directory and reused for
+	// unchanged files. An empty directory disables the cache.
+	void setCacheDirectory(const std::string &directory);
+	// Look sidecar files up in the given directory cache instead of trying to
+	// open each of them, which pays off when loading many files in a row.
+	// The cache is not owned by the fork.
+	void setDirectoryCache(DirectoryCache *cache);
+	bool isMapped() const;
+
+	// Compressed resources ('dcmp' 0, 1 and 2) are decompressed transparently
 	DataPair *getResource(uint32 tag, uint16 id);
+	// Views stay valid until the fork is closed. Unless mapped, a copy of each
+	// viewed resource is kept until then, repeated views share it.
+	DataView getResourceView(uint32 tag, uint16 id);
+	// Shares the cached copy of the resource instead of copying it
+	boost::shared_ptr<const DataPair> getSharedResource(uint32 tag, uint16 id);
 	DataPair *getResource(const std::string &filename);
 	DataPair *getResource(uint32 tag, const std::string &filename);
 
-	const char *getFilename(uint32 tag, uint16 id);
+	// Incremental access to a resource; the reader is invalid in case the
+	// resource does not exist
+	ResourceReader openResource(uint32 tag, uint16 id);
+	uint32 readResource(uint32 tag, uint16 id, uint32 offset, byte *buffer, uint32 size);
+	// Read at most size bytes from the start of a resource, compressed
+	// resources are decompressed straight into the buffer, only as far as
+	// needed, and are not cached.
+	// Returns the bytes read in size and the size of the whole resource.
+	bool readResourceStart(uint32 tag, uint16 id, byte *buffer, uint32 &size, uint32 &length);
+
+	std::string getFilename(uint32 tag, uint16 id) const;
+
+	// Resource data read from the file is kept in a least recently used
+	// cache keyed by data offset, bounded by the given number of bytes. A
+	// budget of 0 disables the cache.
+	void setCacheBudget(uint32 bytes);
+	uint32 getCacheBudget() const;
+	uint32 getCacheSize() const;
+	uint32 getCacheHits() const;
+	uint32 getCacheMisses() const;
 
 	std::vector<uint32> getTagArray();
+	// IDs of the first type with the given tag, in file order
 	std::vector<uint16> getIDArray(uint32 tag);
 
+	// Iterate the resource index, which is sorted by tag and id
+	typedef std::vector<ResourceIndexEntry>::const_iterator IndexIterator;
+	typedef std::pair<IndexIterator, IndexIterator> IndexRange;
+
+	IndexIterator beginIndex() const { return _index.begin(); }
+	IndexIterator endIndex() const { return _index.end(); }
+	IndexRange getIDRange(uint32 tag) const;
+
 private:
-	bool loadFromRawFork(std::string filename);
-	bool loadFromMacBaseFilename(std::string filename);
-	bool loadFromMacBinary(std::string filename);
-	bool loadFromAppleDouble(std::string filename);
+	static const uint32 kSniffSize = 128;
+	static const uint32 kDefaultCacheBudget = 4 * 1024 * 1024;
+
+	bool loadFile(const std::string &filename, bool mapFile, ResourceForkContainer container);
+	bool openFile(const std::string &filename, bool mapFile);
+	uint32 readHeader(byte *header, uint32 size);
+	bool readData(uint32 offset, byte *buffer, uint32 size);
+	bool readFileData(uint64 offset, byte *buffer, uint32 size);
+	ResourceForkContainer detectContainer(const byte *header, uint32 headerSize) const;
 
-	bool loadInternal(uint32 startOffset = 0);
+	bool loadFromMacBaseFilename(std::string filename, bool mapFile);
+	bool loadFromSidecar(const std::string &filename, bool mapFile);
+	bool loadFromVolume(const std::string &filename);
+	bool loadFromMacBinary(const byte *header, uint32 headerSize);
+	bool loadFromAppleDouble(const byte *header, uint32 headerSize);
+	bool loadFromBinHex();
 
-	FILE *_file;
+	bool loadInternal(const byte *header, uint32 headerSize, uint32 startOffset);
+	MapCache::Key getCacheKey(const std::string &filename, const byte *header, uint32 headerSize, ResourceForkContainer container) const;
+	void buildIndex();
+	void buildNameIndex() const;
+	static uint32 hashName(const byte *name, uint32 length);
+	static bool compareNames(const DataView &name1, const std::string &name2);
+	const ResourceIndexEntry *findResource(uint32 tag, uint16 id) const;
+	const ResourceIndexEntry *findResource(uint32 tag, const std::string &filename, bool matchTag) const;
+	friend class ResourceReader;
+
+	bool getDataLength(uint32 offset, uint32 &length);
+	DataView getMappedData(uint32 offset);
+	DataPair *readResource(uint32 offset);
+	bool isCompressed(uint32 offset, uint32 length);
+	boost::shared_ptr<const DataPair> readCachedResource(uint32 offset);
+	DataPair *copyResource(const ResourceIndexEntry *res);
+	void trimCache(uint32 budget);
+
+	int _fd;
+	uint32 _fileSize;
+	int64 _fileMTime;
+	std::string _cacheDirectory;
+	DirectoryCache *_directoryCache;
 	std::vector<ResourceForkType> _types;
+	ResourceTable _table;
+	std::vector<ResourceIndexEntry> _index;
+
+	// Maps the hash of a case folded name to the position in _index
+	typedef boost::unordered_multimap<uint32, uint32> NameIndex;
+	// Built on the first lookup by name, so names are not decoded on loading
+	mutable NameIndex _nameIndex;
+	mutable bool _nameIndexBuilt;
+	mutable boost::mutex _nameIndexMutex;
+
+	const byte *_mapping;
+	uint32 _mappingSize;
+
+	// Where the fork is stored in a disk image, empty for regular files
+	std::vector<HFSExtent> _extents;
+
+	// Resource fork decoded into memory, _mapping points to it when in use
+	std::vector<byte> _decodedFork;
+
+	// Buffers backing views handed out when the file is not mapped, keyed by
+	// data offset
+	typedef boost::unordered_map<uint32, boost::shared_ptr<const DataPair> > ViewBufferMap;
+	ViewBufferMap _viewBuffers;
+	boost::mutex _viewBuffersMutex;
+
+	// Least recently used resource data, most recent first
+	typedef std::list<std::pair<uint32, boost::shared_ptr<const DataPair> > > CacheList;
+	CacheList _cache;
+	boost::unordered_map<uint32, CacheList::iterator> _cacheIndex;
+	uint32 _cacheBudget;
+	uint32 _cacheSize;
+	uint32 _cacheHits;
+	uint32 _cacheMisses;
+	mutable boost::mutex _cacheMutex;
 };
 
 #endif
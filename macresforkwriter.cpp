@@ -0,0 +1,301 @@
+/* macresforkwriter.cpp: Mac resource fork writer
+ * Copyright (c) 2010-2011 Matthew Hoops (clone2727)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "macresforkwriter.h"
+
+#define FORK_DATAOFFSET 256
+#define MAP_TYPELIST 28
+#define MAX_DATASIZE 0x1000000
+
+ResourceForkWriter::ResourceForkWriter() {
+	_fileType = 0x3F3F3F3F; // '????'
+	_fileCreator = 0x3F3F3F3F;
+}
+
+bool ResourceForkWriter::addResource(uint32 tag, uint16 id, const byte *data, uint32 length, const std::string &name) {
+	if (name.size() > 255)
+		return false;
+
+	for (uint32 i = 0; i < _entries.size(); i++)
+		if (_entries[i].tag == tag && _entries[i].id == id)
+			return false;
+
+	Entry entry;
+	entry.tag = tag;
+	entry.id = id;
+	entry.dataOffset = _data.size();
+	entry.nameOffset = kNoName;
+
+	if (!name.empty()) {
+		entry.nameOffset = _names.size();
+		_names.push_back(name.size());
+		_names.insert(_names.end(), name.begin(), name.end());
+	}
+
+	_data.resize(_data.size() + 4 + length);
+	WRITE_UINT32_BE(&_data[entry.dataOffset], length);
+
+	if (length)
+		std::memcpy(&_data[entry.dataOffset + 4], data, length);
+
+	_entries.push_back(entry);
+	return true;
+}
+
+bool ResourceForkWriter::addResource(uint32 tag, uint16 id, const std::vector<byte> &data, const std::string &name) {
+	return addResource(tag, id, data.empty() ? 0 : &data[0], data.size(), name);
+}
+
+void ResourceForkWriter::clear() {
+	_entries.clear();
+	_data.clear();
+	_names.clear();
+}
+
+void ResourceForkWriter::setFileInfo(const std::string &name, uint32 type, uint32 creator) {
+	_fileName = name;
+	_fileType = type;
+	_fileCreator = creator;
+}
+
+bool ResourceForkWriter::serialize(std::vector<byte> &fork) const {
+	// Group the resources by type, keeping the order of first appearance
+	std::vector<uint32> tags;
+	std::vector<std::vector<uint32> > typeEntries;
+
+	for (uint32 i = 0; i < _entries.size(); i++) {
+		uint32 type = std::find(tags.begin(), tags.end(), _entries[i].tag) - tags.begin();
+
+		if (type == tags.size()) {
+			tags.push_back(_entries[i].tag);
+			typeEntries.push_back(std::vector<uint32>());
+		}
+
+		typeEntries[type].push_back(i);
+	}
+
+	if (tags.size() > 0x10000 || _data.size() > MAX_DATASIZE)
+		return false;
+
+	// Reference list offsets are only 16 bits wide, so the biggest lists are
+	// placed last to fit as many resources as possible
+	std::vector<std::pair<uint32, uint32> > refOrder;
+
+	for (uint32 i = 0; i < tags.size(); i++) {
+		if (typeEntries[i].size() > 0x10000)
+			return false;
+
+		refOrder.push_back(std::make_pair(typeEntries[i].size(), i));
+	}
+
+	std::sort(refOrder.begin(), refOrder.end());
+
+	std::vector<uint32> refOffsets(tags.size());
+	uint32 refOffset = 2 + tags.size() * 8;
+
+	for (uint32 i = 0; i < refOrder.size(); i++) {
+		if (refOffset > 0xffff)
+			return false;
+
+		refOffsets[refOrder[i].second] = refOffset;
+		refOffset += refOrder[i].first * 12;
+	}
+
+	uint32 nameListOffset = MAP_TYPELIST + refOffset;
+	uint32 mapLength = nameListOffset + _names.size();
+
+	// Without any names the name list offset is never used
+	if (_names.empty())
+		nameListOffset = std::min<uint32>(nameListOffset, 0xffff);
+	else if (nameListOffset > 0xffff || _names.size() > 0xffff)
+		return false;
+
+	const uint32 mapOffset = FORK_DATAOFFSET + _data.size();
+
+	fork.clear();
+	fork.resize(mapOffset + mapLength, 0);
+
+	// Fork header, which is repeated at the start of the map
+	WRITE_UINT32_BE(&fork[0], FORK_DATAOFFSET);
+	WRITE_UINT32_BE(&fork[4], mapOffset);
+	WRITE_UINT32_BE(&fork[8], _data.size());
+	WRITE_UINT32_BE(&fork[12], mapLength);
+
+	if (!_data.empty())
+		std::memcpy(&fork[FORK_DATAOFFSET], &_data[0], _data.size());
+
+	byte *map = &fork[mapOffset];
+	std::memcpy(map, &fork[0], 16);
+	WRITE_UINT16_BE(map + 24, MAP_TYPELIST);
+	WRITE_UINT16_BE(map + 26, nameListOffset);
+
+	byte *typeList = map + MAP_TYPELIST;
+	WRITE_UINT16_BE(typeList, tags.size() - 1);
+
+	for (uint32 i = 0; i < tags.size(); i++) {
+		byte *type = typeList + 2 + i * 8;
+		WRITE_UINT32_BE(type, tags[i]);
+		WRITE_UINT16_BE(type + 4, typeEntries[i].size() - 1);
+		WRITE_UINT16_BE(type + 6, refOffsets[i]);
+
+		byte *ref = typeList + refOffsets[i];
+
+		for (uint32 j = 0; j < typeEntries[i].size(); j++, ref += 12) {
+			const Entry &entry = _entries[typeEntries[i][j]];
+
+			WRITE_UINT16_BE(ref, entry.id);
+			WRITE_UINT16_BE(ref + 2, entry.nameOffset == kNoName ? 0xffff : entry.nameOffset);
+			WRITE_UINT32_BE(ref + 4, entry.dataOffset);
+		}
+	}
+
+	if (!_names.empty())
+		std::memcpy(map + nameListOffset, &_names[0], _names.size());
+
+	return true;
+}
+
+bool ResourceForkWriter::save(const char *filename, ResourceForkContainer container) const {
+	std::vector<byte> fork;
+
+	if (!serialize(fork))
+		return false;
+
+	// There is no BinHex encoder
+	if (container == kContainerBinHex)
+		return false;
+
+	std::string path = filename;
+
+	if (container == kContainerNamedFork) {
+#ifdef __APPLE__
+		path += "/..namedfork/rsrc";
+#else
+		return false;
+#endif
+	}
+
+	FILE *file = fopen(path.c_str(), "wb");
+
+	if (!file)
+		return false;
+
+	bool written;
+
+	switch (container) {
+	case kContainerMacBinary:
+		written = saveMacBinary(file, fork);
+		break;
+	case kContainerAppleDouble:
+		written = saveAppleDouble(file, fork);
+		break;
+	default:
+		written = fwrite(&fork[0], 1, fork.size(), file) == fork.size();
+		break;
+	}
+
+	written = (fclose(file) == 0) && written;
+	return written;
+}
+
+void ResourceForkWriter::writeFinderInfo(byte *info) const {
+	WRITE_UINT32_BE(info + 0, _fileType);
+	WRITE_UINT32_BE(info + 4, _fileCreator);
+}
+
+#define MBI_INFOHDR 128
+#define MBI_NAMELEN 1
+#define MBI_NAME 2
+#define MBI_FINDERINFO 65
+#define MBI_DFLEN 83
+#define MBI_RFLEN 87
+#define MBI_VERSION 122
+#define MBI_MINVERSION 123
+#define MBI_CRC 124
+#define MAXNAMELEN 63
+
+static uint16 crc16(const byte *data, uint32 size) {
+	// CRC-16/XMODEM, as used by MacBinary II
+	uint16 crc = 0;
+
+	for (uint32 i = 0; i < size; i++) {
+		crc ^= data[i] << 8;
+
+		for (int j = 0; j < 8; j++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+
+	return crc;
+}
+
+bool ResourceForkWriter::saveMacBinary(FILE *file, const std::vector<byte> &fork) const {
+	byte header[MBI_INFOHDR];
+	std::memset(header, 0, sizeof(header));
+
+	const std::string name = _fileName.empty() ? std::string("Untitled") : _fileName.substr(0, MAXNAMELEN);
+	header[MBI_NAMELEN] = name.size();
+	std::memcpy(header + MBI_NAME, name.c_str(), name.size());
+	writeFinderInfo(header + MBI_FINDERINFO);
+	WRITE_UINT32_BE(header + MBI_DFLEN, 0);
+	WRITE_UINT32_BE(header + MBI_RFLEN, fork.size());
+	header[MBI_VERSION] = 129;
+	header[MBI_MINVERSION] = 129;
+	WRITE_UINT16_BE(header + MBI_CRC, crc16(header, MBI_CRC));
+
+	// The (empty) data fork and the resource fork are padded to 128 bytes
+	std::vector<byte> padding((128 - fork.size() % 128) % 128, 0);
+
+	return fwrite(header, 1, MBI_INFOHDR, file) == MBI_INFOHDR
+	    && fwrite(&fork[0], 1, fork.size(), file) == fork.size()
+	    && (padding.empty() || fwrite(&padding[0], 1, padding.size(), file) == padding.size());
+}
+
+#define AD_MAGIC 0x00051607
+#define AD_VERSION 0x00020000
+#define AD_ENTRIES 26
+#define AD_RSRCFORK 2
+#define AD_FINDERINFO 9
+#define AD_FINDERINFOLEN 32
+
+bool ResourceForkWriter::saveAppleDouble(FILE *file, const std::vector<byte> &fork) const {
+	const uint32 headerSize = AD_ENTRIES + 2 * 12 + AD_FINDERINFOLEN;
+	byte header[headerSize];
+	std::memset(header, 0, sizeof(header));
+
+	WRITE_UINT32_BE(header + 0, AD_MAGIC);
+	WRITE_UINT32_BE(header + 4, AD_VERSION);
+	WRITE_UINT16_BE(header + 24, 2);
+
+	// Finder info entry followed by the resource fork entry
+	WRITE_UINT32_BE(header + AD_ENTRIES + 0, AD_FINDERINFO);
+	WRITE_UINT32_BE(header + AD_ENTRIES + 4, AD_ENTRIES + 2 * 12);
+	WRITE_UINT32_BE(header + AD_ENTRIES + 8, AD_FINDERINFOLEN);
+	WRITE_UINT32_BE(header + AD_ENTRIES + 12, AD_RSRCFORK);
+	WRITE_UINT32_BE(header + AD_ENTRIES + 16, headerSize);
+	WRITE_UINT32_BE(header + AD_ENTRIES + 20, fork.size());
+
+	writeFinderInfo(header + AD_ENTRIES + 2 * 12);
+
+	return fwrite(header, 1, headerSize, file) == headerSize
+	    && fwrite(&fork[0], 1, fork.size(), file) == fork.size();
+}
@@ -0,0 +1,73 @@
+/* macresforkwriter.h: Mac resource fork writer
+ * Copyright (c) 2010-2011 Matthew Hoops (clone2727)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef MACRESFORKWRITER_H
+#define MACRESFORKWRITER_H
+
+#include <string>
+#include <vector>
+#include "macresfork.h"
+
+// Builds a resource fork in memory and writes it in any of the containers
+// ResourceFork can load.
+class ResourceForkWriter {
+public:
+	ResourceForkWriter();
+
+	// The data is copied. Fails for duplicate resources and names longer than
+	// 255 characters.
+	bool addResource(uint32 tag, uint16 id, const byte *data, uint32 length, const std::string &name = std::string());
+	bool addResource(uint32 tag, uint16 id, const std::vector<byte> &data, const std::string &name = std::string());
+	void clear();
+
+	uint32 getResourceCount() const { return _entries.size(); }
+
+	// Finder information used for the MacBinary and AppleDouble containers
+	void setFileInfo(const std::string &name, uint32 type, uint32 creator);
+
+	// Build the raw resource fork. Fails in case the resources do not fit
+	// into the limits of the resource map.
+	bool serialize(std::vector<byte> &fork) const;
+
+	bool save(const char *filename, ResourceForkContainer container = kContainerRaw) const;
+
+private:
+	struct Entry {
+		uint32 tag;
+		uint16 id;
+		uint32 nameOffset; // Offset into the name list or kNoName
+		uint32 dataOffset; // Offset into the data area
+	};
+
+	static const uint32 kNoName = 0xffffffff;
+
+	bool saveMacBinary(FILE *file, const std::vector<byte> &fork) const;
+	bool saveAppleDouble(FILE *file, const std::vector<byte> &fork) const;
+	void writeFinderInfo(byte *info) const;
+
+	std::vector<Entry> _entries;
+	std::vector<byte> _data;  // The data area, each resource prefixed by its length
+	std::vector<byte> _names; // The name list as Pascal strings
+
+	std::string _fileName;
+	uint32 _fileType;
+	uint32 _fileCreator;
+};
+
+#endif
@@ -0,0 +1,514 @@
+/**
+ * Copyright (c) 2011 Johannes Schickel (LordHoto)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+// Generator for synthetic executables, used to test and benchmark the
+// loader with inputs of arbitrary size.
+
+#include "macresforkwriter.h"
+#include "dcmp.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+const uint32 kCodeTag = 0x434F4445;
+const uint32 kDataTag = 0x44415441;
+
+/**
+ * Parameters of the generated executable.
+ */
+struct SynthOptions {
+	SynthOptions()
+	    : segments(4), segmentSize(1024), entries(4), relocations(0), globalsSize(256),
+	      model32Bit(false), a5Init(false), data00(false), compression(-1), container(kContainerRaw) {}
+
+	/**
+	 * Number of regular CODE segments.
+	 */
+	uint32 segments;
+
+	/**
+	 * Size of the code in each segment, excluding the header.
+	 */
+	uint32 segmentSize;
+
+	/**
+	 * Number of jump table entries exported by each segment.
+	 */
+	uint32 entries;
+
+	/**
+	 * Number of relocations per 32bit segment and in the %A5Init world.
+	 */
+	uint32 relocations;
+
+	/**
+	 * Size of the application globals below A5.
+	 */
+	uint32 globalsSize;
+
+	/**
+	 * Whether to use the 32bit segment format.
+	 */
+	bool model32Bit;
+
+	/**
+	 * Whether to add an %A5Init segment.
+	 */
+	bool a5Init;
+
+	/**
+	 * Whether to add a DATA 0 resource and its loader segment.
+	 */
+	bool data00;
+
+	/**
+	 * The 'dcmp' id to compress the code segments with, -1 for none.
+	 */
+	int16 compression;
+
+	/**
+	 * The container to write.
+	 */
+	ResourceForkContainer container;
+};
+
+/**
+ * Builder for a synthetic executable.
+ */
+class SynthExecutable {
+public:
+	SynthExecutable(const SynthOptions &options) : _options(options), _jumpTable(), _writer() {}
+
+	/**
+	 * Build all resources.
+	 *
+	 * @throws std::exception Invalid options.
+	 */
+	void build() throw(std::exception);
+
+	/**
+	 * Write the executable.
+	 *
+	 * @param filename The file to write to.
+	 * @throws std::exception Errors on writing.
+	 */
+	void save(const std::string &filename) throw(std::exception);
+
+private:
+	/**
+	 * Add a jump table entry for the given segment.
+	 *
+	 * @param id The segment id.
+	 * @param functionOffset Offset of the function inside the segment.
+	 */
+	void addJumpTableEntry(uint16 id, uint32 functionOffset);
+
+	/**
+	 * Add a code segment, compressed in case it is requested.
+	 *
+	 * @param id The segment id.
+	 * @param data The segment data.
+	 * @param name The segment name.
+	 */
+	void addCodeSegment(uint16 id, const std::vector<byte> &data, const std::string &name);
+
+	/**
+	 * Build a regular code segment.
+	 *
+	 * @param id The segment id.
+	 */
+	std::vector<byte> buildCodeSegment(uint16 id);
+
+	/**
+	 * Create the header of a segment and fill its code with NOPs.
+	 *
+	 * @param id The segment id.
+	 * @param codeSize The size of the code after the header.
+	 * @param entries The number of exported functions.
+	 * @param functionOffsets The offsets of the exported functions.
+	 */
+	std::vector<byte> createSegment(uint16 id, uint32 codeSize, uint32 entries, const std::vector<uint32> &functionOffsets);
+
+	/**
+	 * Build the %A5Init segment and its compressed world.
+	 *
+	 * @param id The segment id.
+	 */
+	std::vector<byte> buildA5InitSegment(uint16 id);
+
+	/**
+	 * Build the segment the DATA00 loader hooks onto.
+	 *
+	 * @param id The segment id.
+	 */
+	std::vector<byte> buildData00Segment(uint16 id);
+
+	/**
+	 * Build the compressed DATA 0 resource.
+	 */
+	std::vector<byte> buildData00Resource();
+
+	/**
+	 * Build the CODE 0 segment from the collected jump table.
+	 */
+	std::vector<byte> buildCode0Segment();
+
+	/**
+	 * Size of a segment header.
+	 */
+	uint32 getHeaderSize() const { return _options.model32Bit ? 40 : 4; }
+
+	const SynthOptions &_options;
+
+	/**
+	 * The jump table entries added so far.
+	 */
+	std::vector<byte> _jumpTable;
+
+	/**
+	 * The resource fork being built.
+	 */
+	ResourceForkWriter _writer;
+};
+
+void SynthExecutable::build() throw(std::exception) {
+	_jumpTable.clear();
+	_writer.clear();
+
+	if (_options.data00 && _options.model32Bit)
+		throw std::runtime_error("DATA 0 is only supported for the near model");
+	// The loader's detection of near %A5Init segments places the info block
+	// over its own offset, which no sensible world size satisfies.
+	if (_options.a5Init && !_options.model32Bit)
+		throw std::runtime_error("%A5Init is only supported for 32bit segments");
+	if (_options.entries == 0 || _options.segmentSize < _options.entries * 2)
+		throw std::runtime_error("Segments are too small for the requested number of entries");
+
+	uint16 id = 1;
+
+	// The DATA00 loader requires its segment to own the first jump table entry
+	if (_options.data00) {
+		addCodeSegment(id, buildData00Segment(id), "DATA");
+		_writer.addResource(kDataTag, 0, buildData00Resource());
+		id++;
+	}
+
+	for (uint32 i = 0; i < _options.segments; i++, id++) {
+		if (id == 0)
+			throw std::runtime_error("Too many segments");
+
+		addCodeSegment(id, buildCodeSegment(id), "Seg" + std::string(1, 'A' + i % 26));
+	}
+
+	if (_options.a5Init)
+		addCodeSegment(id, buildA5InitSegment(id), "%A5Init");
+
+	// CODE 0 is built last, since it contains the jump table
+	_writer.addResource(kCodeTag, 0, buildCode0Segment());
+	_writer.setFileInfo("Synthetic", 0x4150504C, 0x3F3F3F3F); // 'APPL' '????'
+}
+
+void SynthExecutable::save(const std::string &filename) throw(std::exception) {
+	if (!_writer.save(filename.c_str(), _options.container))
+		throw std::runtime_error("Could not write file " + filename + " (the resource map might exceed its limits)");
+}
+
+void SynthExecutable::addCodeSegment(uint16 id, const std::vector<byte> &data, const std::string &name) {
+	if (_options.compression < 0) {
+		_writer.addResource(kCodeTag, id, data, name);
+		return;
+	}
+
+	std::vector<byte> compressed;
+
+	if (!Dcmp::compress(_options.compression, &data[0], data.size(), compressed))
+		throw std::runtime_error("Unsupported compression");
+
+	_writer.addResource(kCodeTag, id, compressed, name);
+}
+
+void SynthExecutable::addJumpTableEntry(uint16 id, uint32 functionOffset) {
+	byte entry[8];
+
+	if (_options.model32Bit) {
+		WRITE_UINT16_BE(entry + 0, id);
+		WRITE_UINT16_BE(entry + 2, 0xA9F0);
+		WRITE_UINT32_BE(entry + 4, functionOffset);
+	} else {
+		WRITE_UINT16_BE(entry + 0, functionOffset);
+		WRITE_UINT16_BE(entry + 2, 0x3F3C);
+		WRITE_UINT16_BE(entry + 4, id);
+		WRITE_UINT16_BE(entry + 6, 0xA9F0);
+	}
+
+	_jumpTable.insert(_jumpTable.end(), entry, entry + 8);
+}
+
+std::vector<byte> SynthExecutable::createSegment(uint16 id, uint32 codeSize, uint32 entries, const std::vector<uint32> &functionOffsets) {
+	const uint32 jumpTableOffset = _jumpTable.size();
+	const uint32 headerSize = getHeaderSize();
+
+	if (!_options.model32Bit && jumpTableOffset + entries * 8 > 0xFFFF)
+		throw std::runtime_error("The jump table is too big for the near model");
+
+	std::vector<byte> segment(headerSize + codeSize + (codeSize & 1), 0);
+
+	// Fill the code with NOPs
+	for (uint32 i = headerSize; i + 1 < segment.size(); i += 2)
+		WRITE_UINT16_BE(&segment[i], 0x4E71);
+
+	if (_options.model32Bit) {
+		WRITE_UINT16_BE(&segment[0], 0xFFFF);
+		WRITE_UINT16_BE(&segment[2], 0x0000);
+		WRITE_UINT32_BE(&segment[4], jumpTableOffset);
+		WRITE_UINT32_BE(&segment[8], entries);
+	} else {
+		WRITE_UINT16_BE(&segment[0], jumpTableOffset);
+		WRITE_UINT16_BE(&segment[2], entries);
+	}
+
+	// 32bit entries are relative to the segment start, near ones to the code
+	for (uint32 i = 0; i < entries; i++)
+		addJumpTableEntry(id, functionOffsets[i] + (_options.model32Bit ? headerSize : 0));
+
+	return segment;
+}
+
+std::vector<byte> SynthExecutable::buildCodeSegment(uint16 id) {
+	const uint32 headerSize = getHeaderSize();
+	const uint32 stride = (_options.segmentSize / _options.entries) & ~1;
+
+	std::vector<uint32> functionOffsets;
+	for (uint32 i = 0; i < _options.entries; i++)
+		functionOffsets.push_back(i * stride);
+
+	std::vector<byte> segment = createSegment(id, _options.segmentSize, _options.entries, functionOffsets);
+
+	// Each function is a single RTS
+	for (uint32 i = 0; i < _options.entries; i++)
+		WRITE_UINT16_BE(&segment[headerSize + functionOffsets[i]], 0x4E75);
+
+	if (!_options.model32Bit || !_options.relocations || _options.segmentSize < 8)
+		return segment;
+
+	// Spread the segment relocations over the code. The relocation stream
+	// can only encode gaps of up to 64KB.
+	const uint32 relocations = std::min(_options.relocations, _options.segmentSize / 4 - 1);
+	const uint32 gap = std::min<uint32>((_options.segmentSize - 4) / relocations, 0xFFFE) & ~1;
+
+	WRITE_UINT32_BE(&segment[28], segment.size());
+
+	for (uint32 i = 0; i < relocations; i++) {
+		// The first relocation is relative to the segment start
+		const uint32 delta = (i == 0 ? headerSize + gap : gap) / 2;
+
+		if (delta < 0x80) {
+			segment.push_back(delta);
+		} else {
+			segment.push_back(0x80 | (delta >> 8));
+			segment.push_back(delta & 0xFF);
+		}
+	}
+
+	segment.push_back(0);
+	segment.push_back(0);
+	segment.resize(segment.size() + (segment.size() & 1), 0);
+	return segment;
+}
+
+std::vector<byte> SynthExecutable::buildA5InitSegment(uint16 id) {
+	// The loader finds the info block through a 16bit offset at 46
+	const uint32 infoPointer = 46;
+	const uint32 infoOffset = 48;
+
+	std::vector<uint32> functionOffsets(1, 0);
+	std::vector<byte> segment = createSegment(id, infoOffset + 16 - getHeaderSize(), 1, functionOffsets);
+	segment.resize(infoOffset + 16, 0);
+
+	WRITE_UINT16_BE(&segment[infoPointer], infoOffset - infoPointer);
+
+	// Compress the world as a sequence of 30 byte literal runs
+	const uint32 runs = _options.globalsSize / 30;
+	std::vector<byte> world;
+
+	for (uint32 i = 0; i < runs; i++) {
+		world.push_back(0x0F);
+		world.push_back(0x00);
+
+		for (uint32 j = 0; j < 30; j++)
+			world.push_back(i + j);
+	}
+
+	world.push_back(0x00);
+	world.push_back(0x00);
+
+	// Relocate every 16th byte
+	std::vector<byte> relocation;
+	const uint32 relocations = _options.globalsSize >= 32 ? std::min(_options.relocations, _options.globalsSize / 16 - 1) : 0;
+
+	for (uint32 i = 0; i < relocations; i++)
+		relocation.push_back(0x08);
+
+	relocation.push_back(0x00);
+	relocation.push_back(0x00);
+
+	WRITE_UINT32_BE(&segment[infoOffset + 0], _options.globalsSize);
+	WRITE_UINT16_BE(&segment[infoOffset + 4], 1);
+	WRITE_UINT32_BE(&segment[infoOffset + 8], 16);
+	WRITE_UINT32_BE(&segment[infoOffset + 12], 16 + world.size());
+
+	segment.insert(segment.end(), world.begin(), world.end());
+	segment.insert(segment.end(), relocation.begin(), relocation.end());
+	return segment;
+}
+
+std::vector<byte> SynthExecutable::buildData00Segment(uint16 id) {
+	std::vector<uint32> functionOffsets(1, 0);
+	std::vector<byte> segment = createSegment(id, 0x210, 1, functionOffsets);
+
+	// The tags the DATA00 loader looks for
+	WRITE_UINT32_BE(&segment[0x0A], kCodeTag);
+	WRITE_UINT32_BE(&segment[0x44], kDataTag);
+	return segment;
+}
+
+std::vector<byte> SynthExecutable::buildData00Resource() {
+	std::vector<byte> data(4, 0);
+	byte offset[4];
+
+	// The first block initializes the globals with literal runs
+	WRITE_UINT32_BE(offset, -(int32)_options.globalsSize);
+	data.insert(data.end(), offset, offset + 4);
+
+	for (uint32 left = _options.globalsSize; left > 0; ) {
+		const uint32 count = std::min<uint32>(left, 128);
+
+		data.push_back(0x80 | (count - 1));
+		for (uint32 i = 0; i < count; i++)
+			data.push_back(left - i);
+
+		left -= count;
+	}
+
+	data.push_back(0x00);
+
+	// The remaining two blocks are empty
+	for (uint32 i = 0; i < 2; i++) {
+		data.insert(data.end(), offset, offset + 4);
+		data.push_back(0x00);
+	}
+
+	return data;
+}
+
+std::vector<byte> SynthExecutable::buildCode0Segment() {
+	const uint32 jumpTableOffset = 32;
+
+	std::vector<byte> segment(16);
+	WRITE_UINT32_BE(&segment[0], jumpTableOffset + _jumpTable.size());
+	WRITE_UINT32_BE(&segment[4], _options.globalsSize);
+	WRITE_UINT32_BE(&segment[8], _jumpTable.size());
+	WRITE_UINT32_BE(&segment[12], jumpTableOffset);
+
+	segment.insert(segment.end(), _jumpTable.begin(), _jumpTable.end());
+	return segment;
+}
+
+static void printUsage(const char *name) {
+	std::cerr << "Usage: " << name << " [options] output\n"
+	             "Options:\n"
+	             "  -n <count>   Number of CODE segments (default 4)\n"
+	             "  -s <size>    Code size of each segment in bytes (default 1024)\n"
+	             "  -e <count>   Jump table entries per segment (default 4)\n"
+	             "  -r <count>   Relocations per 32bit segment and in the %A5Init world\n"
+	             "  -g <size>    Size of the application globals (default 256)\n"
+	             "  -32          Use 32bit segments\n"
+	             "  -a5init      Add an %A5Init segment (32bit only)\n"
+	             "  -data00      Add a DATA 0 resource (near model only)\n"
+	             "  -c <dcmp>    Compress the code segments with 'dcmp' 0, 1 or 2\n"
+	             "  -f <format>  Container: raw, macbinary or appledouble (default raw)\n";
+}
+
+int main(int argc, char *argv[]) {
+	SynthOptions options;
+	std::string output;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		const bool hasValue = (i + 1 < argc);
+
+		if (arg == "-n" && hasValue) {
+			options.segments = std::strtoul(argv[++i], 0, 0);
+		} else if (arg == "-s" && hasValue) {
+			options.segmentSize = std::strtoul(argv[++i], 0, 0);
+		} else if (arg == "-e" && hasValue) {
+			options.entries = std::strtoul(argv[++i], 0, 0);
+		} else if (arg == "-r" && hasValue) {
+			options.relocations = std::strtoul(argv[++i], 0, 0);
+		} else if (arg == "-g" && hasValue) {
+			options.globalsSize = std::strtoul(argv[++i], 0, 0) & ~1;
+		} else if (arg == "-32") {
+			options.model32Bit = true;
+		} else if (arg == "-a5init") {
+			options.a5Init = true;
+		} else if (arg == "-data00") {
+			options.data00 = true;
+		} else if (arg == "-c" && hasValue) {
+			options.compression = std::strtol(argv[++i], 0, 0);
+		} else if (arg == "-f" && hasValue) {
+			const std::string format = argv[++i];
+
+			if (format == "raw") {
+				options.container = kContainerRaw;
+			} else if (format == "macbinary") {
+				options.container = kContainerMacBinary;
+			} else if (format == "appledouble") {
+				options.container = kContainerAppleDouble;
+			} else {
+				printUsage(argv[0]);
+				return -1;
+			}
+		} else if (arg[0] != '-' && output.empty()) {
+			output = arg;
+		} else {
+			printUsage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (output.empty()) {
+		printUsage(argv[0]);
+		return -1;
+	}
+
+	try {
+		SynthExecutable exe(options);
+		exe.build();
+		exe.save(output);
+	} catch (std::exception &e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return -1;
+	}
+
+	return 0;
+}
@@ -19,18 +19,236 @@
 
 #include "macexe.h"
 #include "idc.h"
+#include "dircache.h"
+#include "hfs.h"
 
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
 #include <iostream>
+#include <vector>
+
+/**
+ * File type of applications.
+ */
+const uint32 kApplicationType = 0x4150504C;
+
+/**
+ * Output information about many executables.
+ *
+ * Sidecar resource forks are looked up through a shared directory cache,
+ * thus every directory is only read once.
+ *
+ * @param count Number of files.
+ * @param files The files to load.
+ * @param cacheDirectory Directory where parsed resource maps are cached, empty to disable.
+ * @return 0 in case all files loaded fine, -1 otherwise.
+ */
+static int batchInfo(int count, char *files[], const std::string &cacheDirectory) {
+	DirectoryCache directoryCache;
+	int result = 0;
+
+	for (int i = 0; i < count; ++i) {
+		std::cout << "File: " << files[i] << "\n\n";
+
+		try {
+			Executable exe(files[i], &directoryCache, cacheDirectory);
+			exe.outputInfo(std::cout);
+		} catch (std::exception &e) {
+			std::cout << "Error: " << e.what() << "\n";
+			result = -1;
+		}
+
+		std::cout << std::endl;
+	}
+
+	return result;
+}
+
+/**
+ * Output information about all applications on a disk image.
+ *
+ * The catalog is walked once to find the applications, which are then
+ * loaded straight from the opened image.
+ *
+ * @param image The disk image.
+ * @return 0 in case all applications loaded fine, -1 otherwise.
+ */
+static int imageInfo(const char *image) {
+	HFSVolume volume;
+	std::vector<HFSFile> files;
+
+	if (!volume.open(image) || !volume.listFiles(kApplicationType, files)) {
+		std::cout << "Error: Could not read disk image " << image << std::endl;
+		return -1;
+	}
+
+	int result = 0;
+
+	for (std::vector<HFSFile>::const_iterator i = files.begin(); i != files.end(); ++i) {
+		std::cout << "File: " << image << ":" << i->path << "\n\n";
+
+		try {
+			Executable exe(volume, *i);
+			exe.outputInfo(std::cout);
+		} catch (std::exception &e) {
+			std::cout << "Error: " << e.what() << "\n";
+			result = -1;
+		}
+
+		std::cout << std::endl;
+	}
+
+	return result;
+}
+
+/**
+ * Set the segment order of a layout.
+ *
+ * @param layout The layout to modify.
+ * @param order "id", "size" or a comma separated list of segment ids.
+ */
+static void setSegmentOrder(SegmentLayout &layout, const std::string &order) {
+	if (order == "id") {
+		layout.setOrder(SegmentLayout::kOrderID);
+	} else if (order == "size") {
+		layout.setOrder(SegmentLayout::kOrderSize);
+	} else {
+		std::vector<uint16> ids;
+		const char *list = order.c_str();
+
+		while (true) {
+			char *end;
+			ids.push_back(std::strtoul(list, &end, 0));
+
+			if (*end != ',')
+				break;
+			list = end + 1;
+		}
+
+		layout.setCustomOrder(ids);
+	}
+}
+
+/**
+ * Parse an address given on the command line.
+ *
+ * @param str The address, decimal, octal or hexadecimal.
+ * @param address Where to store the address.
+ * @return true on success, false in case str is no valid 32bit number.
+ */
+static bool parseAddress(const char *str, uint32 &address) {
+	// strtoul accepts white space and a sign, which would silently wrap
+	// the address
+	if (!std::isdigit((unsigned char)*str))
+		return false;
+
+	char *end;
+	errno = 0;
+	const unsigned long value = std::strtoul(str, &end, 0);
+
+	if (*end || errno == ERANGE || value > 0xFFFFFFFFUL)
+		return false;
+
+	address = value;
+	return true;
+}
 
 int main(int argc, char *argv[]) {
 	if (argc < 2)
 		return -1;
 
-	Executable exe(argv[1]);
+	// Cache the parsed resource maps, so reloading the same files is cheap
+	std::string cacheDirectory;
+	if (std::string(argv[1]) == "-c" && argc >= 4) {
+		cacheDirectory = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (std::string(argv[1]) == "-b")
+		return batchInfo(argc - 2, argv + 2, cacheDirectory);
+
+	if (std::string(argv[1]) == "-i" && argc >= 3)
+		return imageInfo(argv[2]);
+
+	if (std::string(argv[1]) == "-j" && argc >= 3) {
+		Executable exe(argv[2]);
+		return exe.outputJumpTableIndex(std::cout) ? 0 : -1;
+	}
+
+	// Move an existing memory dump to another base address
+	if (std::string(argv[1]) == "-rebase" && argc >= 4) {
+		uint32 base;
+		if (!parseAddress(argv[3], base)) {
+			std::cout << "Error: Invalid base address " << argv[3] << std::endl;
+			return -1;
+		}
+
+		try {
+			RelocationFile::rebase(argv[2], std::string(argv[2]) + ".reloc", base);
+		} catch (std::exception &e) {
+			std::cout << "Error: " << e.what() << std::endl;
+			return -1;
+		}
+
+		return 0;
+	}
+
+	uint threads = 1;
+	bool writeRelocations = false;
+	bool mappedOutput = false;
+	SegmentLayout layout;
+
+	while (argc >= 3) {
+		const std::string option = argv[1];
+
+		if (option == "-t" && argc >= 4) {
+			// Copy and relocate the segments with several threads
+			threads = std::atoi(argv[2]);
+			argc -= 2;
+			argv += 2;
+		} else if (option == "-a" && argc >= 4) {
+			// Align the segments to pages, cache lines or a given boundary
+			const std::string alignment = argv[2];
+			if (alignment == "page")
+				layout.setAlignment(SegmentLayout::kPageAlignment);
+			else if (alignment == "cacheline")
+				layout.setAlignment(SegmentLayout::kCacheLineAlignment);
+			else
+				layout.setAlignment(std::strtoul(argv[2], 0, 0));
+			argc -= 2;
+			argv += 2;
+		} else if (option == "-o" && argc >= 4) {
+			// Order the segments by id, by size or as listed
+			setSegmentOrder(layout, argv[2]);
+			argc -= 2;
+			argv += 2;
+		} else if (option == "-m") {
+			// Write the memory dump through a mapping of the file
+			mappedOutput = true;
+			--argc;
+			++argv;
+		} else if (option == "-r") {
+			// Write a relocation file next to the memory dump
+			writeRelocations = true;
+			--argc;
+			++argv;
+		} else {
+			break;
+		}
+	}
+
+	Executable exe(argv[1], 0, cacheDirectory);
+	exe.setThreadCount(threads);
+	exe.setSegmentLayout(layout);
+	exe.setMappedOutput(mappedOutput);
 	exe.outputInfo(std::cout);
 	if (argc >= 3) {
 		exe.writeMemoryDump(argv[2], std::cout);
 		IDC::writeMemDumpInitScript(exe, argv[2]);
+
+		if (writeRelocations)
+			exe.writeRelocationFile(std::string(argv[2]) + ".reloc");
 	}
 }
-
@@ -0,0 +1,223 @@
+/* mapcache.cpp: Persistent cache for parsed resource maps
+ * Copyright (c) 2010-2011 Matthew Hoops (clone2727)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapcache.h"
+
+namespace MapCache {
+
+// The cache is only ever read back on the machine which wrote it, so all
+// values are stored in native byte order. The endian marker rejects files
+// copied over from elsewhere.
+#define CACHE_MAGIC 0x524D4150 // 'RMAP'
+#define CACHE_VERSION 2
+#define CACHE_ENDIAN 0x01020304
+
+struct CacheHeader {
+	uint32 magic;
+	uint32 version;
+	uint32 endian;
+	uint32 pathLength;
+	uint64 size;
+	int64 mtime;
+	uint32 headerHash;
+	uint32 container;
+	uint32 typeCount;
+	uint32 resourceCount;
+	uint32 nameListSize;
+	uint32 reserved;
+};
+
+static uint32 hashData(const byte *data, uint32 size, uint32 hash = 2166136261u) {
+	// FNV-1a
+	for (uint32 i = 0; i < size; i++) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+uint32 hashHeader(const byte *header, uint32 size) {
+	return hashData(header, size);
+}
+
+static std::string getCacheFilename(const std::string &directory, const Key &key) {
+	char name[16];
+	sprintf(name, "%08x.rmap", hashData((const byte *)key.path.c_str(), key.path.size()));
+	return directory + "/" + name;
+}
+
+// Size of the data following the header, each block is 4 byte aligned
+static uint32 align4(uint32 size) {
+	return (size + 3) & ~3;
+}
+
+static uint32 getPayloadSize(const CacheHeader &header) {
+	return align4(header.pathLength)
+	     + header.typeCount * 12
+	     + align4(header.resourceCount * 2)
+	     + header.resourceCount * 4
+	     + header.resourceCount * 4
+	     + align4(header.nameListSize);
+}
+
+bool load(const std::string &directory, const Key &key, std::vector<ResourceForkType> &types, ResourceTable &table) {
+	int fd = open(getCacheFilename(directory, key).c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || (uint64)st.st_size < sizeof(CacheHeader)) {
+		::close(fd);
+		return false;
+	}
+
+	void *mapping = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (mapping == MAP_FAILED)
+		return false;
+
+	const byte *data = (const byte *)mapping;
+	CacheHeader header;
+	std::memcpy(&header, data, sizeof(header));
+
+	bool valid = header.magic == CACHE_MAGIC && header.version == CACHE_VERSION && header.endian == CACHE_ENDIAN
+	          && header.size == key.size && header.mtime == key.mtime && header.headerHash == key.headerHash
+	          && header.container == key.container && header.pathLength == key.path.size()
+	          && header.typeCount <= 0x10000 && header.resourceCount <= 0x1000000 && header.nameListSize <= (uint64)st.st_size
+	          && sizeof(CacheHeader) + (uint64)getPayloadSize(header) == (uint64)st.st_size
+	          && std::memcmp(data + sizeof(CacheHeader), key.path.c_str(), key.path.size()) == 0;
+
+	if (valid) {
+		const byte *src = data + sizeof(CacheHeader) + align4(header.pathLength);
+
+		types.resize(header.typeCount);
+		for (uint32 i = 0; i < header.typeCount; i++, src += 12) {
+			std::memcpy(&types[i].tag, src + 0, 4);
+			std::memcpy(&types[i].first, src + 4, 4);
+			std::memcpy(&types[i].count, src + 8, 4);
+
+			// The type ranges have to stay inside the resource table
+			if (types[i].first > header.resourceCount || types[i].count > header.resourceCount - types[i].first)
+				valid = false;
+		}
+
+		table.ids.resize(header.resourceCount);
+		table.offsets.resize(header.resourceCount);
+		table.nameOffsets.resize(header.resourceCount);
+		table.nameList.resize(header.nameListSize);
+
+		if (header.resourceCount) {
+			std::memcpy(&table.ids[0], src, header.resourceCount * 2);
+			src += align4(header.resourceCount * 2);
+			std::memcpy(&table.offsets[0], src, header.resourceCount * 4);
+			src += header.resourceCount * 4;
+			std::memcpy(&table.nameOffsets[0], src, header.resourceCount * 4);
+			src += header.resourceCount * 4;
+		}
+
+		if (header.nameListSize)
+			std::memcpy(&table.nameList[0], src, header.nameListSize);
+
+		if (!valid) {
+			types.clear();
+			table.clear();
+		}
+	}
+
+	munmap(mapping, st.st_size);
+	return valid;
+}
+
+static void append(std::vector<byte> &buffer, const void *data, uint32 size) {
+	buffer.insert(buffer.end(), (const byte *)data, (const byte *)data + size);
+	buffer.resize(align4(buffer.size()), 0);
+}
+
+bool save(const std::string &directory, const Key &key, const std::vector<ResourceForkType> &types, const ResourceTable &table) {
+	CacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+
+	header.magic = CACHE_MAGIC;
+	header.version = CACHE_VERSION;
+	header.endian = CACHE_ENDIAN;
+	header.pathLength = key.path.size();
+	header.size = key.size;
+	header.mtime = key.mtime;
+	header.headerHash = key.headerHash;
+	header.container = key.container;
+	header.typeCount = types.size();
+	header.resourceCount = table.size();
+	header.nameListSize = table.nameList.size();
+
+	std::vector<byte> buffer;
+	buffer.reserve(sizeof(header) + getPayloadSize(header));
+
+	append(buffer, &header, sizeof(header));
+	append(buffer, key.path.c_str(), key.path.size());
+
+	for (uint32 i = 0; i < types.size(); i++) {
+		append(buffer, &types[i].tag, 4);
+		append(buffer, &types[i].first, 4);
+		append(buffer, &types[i].count, 4);
+	}
+
+	if (table.size()) {
+		append(buffer, &table.ids[0], table.size() * 2);
+		append(buffer, &table.offsets[0], table.size() * 4);
+		append(buffer, &table.nameOffsets[0], table.size() * 4);
+	}
+
+	if (!table.nameList.empty())
+		append(buffer, &table.nameList[0], table.nameList.size());
+
+	// Write to a temporary file first, so concurrent readers never see a
+	// partially written cache entry
+	const std::string filename = getCacheFilename(directory, key);
+	char suffix[16];
+	sprintf(suffix, ".%d", (int)getpid());
+	const std::string tempFilename = filename + suffix;
+
+	FILE *file = fopen(tempFilename.c_str(), "wb");
+
+	if (!file)
+		return false;
+
+	bool written = fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size();
+	written = (fclose(file) == 0) && written;
+
+	if (!written || rename(tempFilename.c_str(), filename.c_str()) != 0) {
+		remove(tempFilename.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+} // End of namespace MapCache
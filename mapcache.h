@@ -0,0 +1,52 @@
+/* mapcache.h: Persistent cache for parsed resource maps
+ * Copyright (c) 2010-2011 Matthew Hoops (clone2727)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef MAPCACHE_H
+#define MAPCACHE_H
+
+#include <string>
+#include <vector>
+#include "macresfork.h"
+
+namespace MapCache {
+
+// Identifies one parsed input. A cached map is only used when every field
+// matches, so a changed file is simply parsed again.
+struct Key {
+	Key() { size = 0; mtime = 0; headerHash = 0; container = 0; }
+
+	std::string path;
+	uint64 size;
+	int64 mtime;
+	uint32 headerHash;
+	uint32 container;
+};
+
+// Hash of the sniffed file header, part of the key
+uint32 hashHeader(const byte *header, uint32 size);
+
+// Load a cached map, returns false in case there is no valid cache entry
+bool load(const std::string &directory, const Key &key, std::vector<ResourceForkType> &types, ResourceTable &table);
+
+// Store a parsed map in the cache
+bool save(const std::string &directory, const Key &key, const std::vector<ResourceForkType> &types, const ResourceTable &table);
+
+} // End of namespace MapCache
+
+#endif
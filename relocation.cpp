@@ -0,0 +1,405 @@
+/**
+ * Copyright (c) 2011 Johannes Schickel (LordHoto)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#include "relocation.h"
+#include "bereader.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/bind/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+
+/**
+ * Tables with less relocations are always patched by a single thread.
+ */
+static const uint32 kParallelThreshold = 64 * 1024;
+
+RelocationTable::RelocationTable(Type type, uint16 segmentID)
+    : _type(type), _segmentID(segmentID), _delta(0), _offsets(), _overlapping(false), _errorOffset(0) {
+}
+
+RelocationTable::Status RelocationTable::decode(Encoding encoding, BigEndianReader &src, uint32 base, uint32 size) {
+	_offsets.clear();
+	_overlapping = false;
+	_errorOffset = 0;
+
+	Status status;
+
+	switch (encoding) {
+	case kEncodingCode32:
+		status = decodeCode32(src, base, size);
+		break;
+
+	case kEncodingA5World:
+		status = decodeA5World(src, base, size);
+		break;
+
+	default:
+		status = decodeOffsets(src, base, size);
+		break;
+	}
+
+	if (status != kStatusOK)
+		_offsets.clear();
+
+	return status;
+}
+
+RelocationTable::Status RelocationTable::decodeCode32(BigEndianReader &src, uint32 base, uint32 size) {
+	uint64 target = 0;
+
+	while (true) {
+		uint32 off = src.readByte();
+
+		if (off == 0) {
+			if (!src.peekByte())
+				break;
+
+			off = src.readUint32();
+		} else if (off & 0x80) {
+			off &= 0x7F;
+			off <<= 8;
+			off |= src.readByte();
+		}
+
+		if (src.err())
+			break;
+
+		target += (uint64)off + off;
+
+		if (!add(target, base, size))
+			return kStatusOutOfBounds;
+	}
+
+	return src.err() ? kStatusTruncated : kStatusOK;
+}
+
+RelocationTable::Status RelocationTable::decodeA5World(BigEndianReader &src, uint32 base, uint32 size) {
+	uint64 dst = 0;
+	uint32 dummy = 0;
+
+	while (true) {
+		uint32 loops = 1;
+		uint32 offset = src.readByte();
+
+		if (offset) {
+			if (offset & 0x80) {
+				offset &= 0x7F;
+				offset <<= 8;
+				offset |= src.readByte();
+			}
+		} else {
+			offset = src.readByte();
+			if (!offset)
+				break;
+
+			if (offset & 0x80) {
+				offset <<= 8;
+				offset |= src.readByte();
+				offset <<= 8;
+				offset |= src.readByte();
+				offset <<= 8;
+				offset |= src.readByte();
+			} else {
+				loops = getRunLength(src, dummy);
+			}
+		}
+
+		if (src.err())
+			break;
+
+		offset += offset;
+
+		if (!loops)
+			return kStatusInvalid;
+
+		do {
+			dst += offset;
+
+			if (!add(dst, base, size))
+				return kStatusOutOfBounds;
+		} while (--loops);
+	}
+
+	return src.err() ? kStatusTruncated : kStatusOK;
+}
+
+RelocationTable::Status RelocationTable::decodeOffsets(BigEndianReader &src, uint32 base, uint32 size) {
+	if (src.remaining() % 4 != 0)
+		return kStatusTruncated;
+
+	while (!src.eos()) {
+		const uint32 offset = src.readUint32();
+
+		if (!_offsets.empty() && base + offset < _offsets.back())
+			return kStatusInvalid;
+
+		if (!add(offset, base, size))
+			return kStatusOutOfBounds;
+	}
+
+	return kStatusOK;
+}
+
+void RelocationTable::assign(const std::vector<uint32> &offsets) {
+	_offsets.clear();
+	_overlapping = false;
+	_errorOffset = 0;
+
+	BOOST_FOREACH(uint32 offset, offsets) {
+		assert(_offsets.empty() || offset >= _offsets.back());
+		add(offset, 0, 0xFFFFFFFF);
+	}
+}
+
+uint32 RelocationTable::getRunLength(BigEndianReader &src, uint32 &special) {
+	uint32 rl = src.readByte();
+
+	if (!(rl & 0x80)) {
+		return rl;
+	} else if (!(rl & 0x40)) {
+		rl &= 0x3F;
+		rl <<= 8;
+		rl |= src.readByte();
+		return rl;
+	} else if (!(rl & 0x20)) {
+		rl &= 0x1F;
+		rl <<= 8;
+		rl |= src.readByte();
+		rl <<= 8;
+		rl |= src.readByte();
+		return rl;
+	} else if (!(rl & 0x10)) {
+		return src.readUint32();
+	} else {
+		rl = getRunLength(src, special);
+		special = getRunLength(src, special);
+		return rl;
+	}
+}
+
+bool RelocationTable::add(uint64 offset, uint32 base, uint32 size) {
+	if (offset + 4 > size) {
+		_errorOffset = offset;
+		return false;
+	}
+
+	const uint32 absolute = base + (uint32)offset;
+
+	// Words closer than 4 bytes depend on each other
+	if (!_offsets.empty() && absolute - _offsets.back() < 4)
+		_overlapping = true;
+
+	_offsets.push_back(absolute);
+	return true;
+}
+
+void RelocationTable::apply(byte *memory, uint32 delta, uint threadCount) {
+	_delta = delta;
+
+	const uint32 count = _offsets.size();
+
+	if (threadCount <= 1 || _overlapping || count < kParallelThreshold) {
+		applyRange(memory, 0, count);
+		return;
+	}
+
+	// Split the table into one consecutive chunk per thread
+	threadCount = std::min<uint32>(threadCount, count / (kParallelThreshold / 4));
+
+	boost::thread_group threads;
+	for (uint i = 0; i < threadCount; ++i)
+		threads.create_thread(boost::bind(&RelocationTable::applyRange, this, memory, (uint64)count * i / threadCount, (uint64)count * (i + 1) / threadCount));
+	threads.join_all();
+}
+
+void RelocationTable::applyRange(byte *memory, uint32 first, uint32 last) const {
+	const uint32 *offsets = _offsets.empty() ? 0 : &_offsets[0];
+	const uint32 delta = _delta;
+	uint32 i = first;
+
+	// Independent words are patched four at a time, so the loads are not
+	// serialized behind the stores
+	if (!_overlapping) {
+		for (; i + 4 <= last; i += 4) {
+			byte *word0 = memory + offsets[i + 0];
+			byte *word1 = memory + offsets[i + 1];
+			byte *word2 = memory + offsets[i + 2];
+			byte *word3 = memory + offsets[i + 3];
+
+			const uint32 value0 = READ_UINT32_BE(word0) + delta;
+			const uint32 value1 = READ_UINT32_BE(word1) + delta;
+			const uint32 value2 = READ_UINT32_BE(word2) + delta;
+			const uint32 value3 = READ_UINT32_BE(word3) + delta;
+
+			WRITE_UINT32_BE(word0, value0);
+			WRITE_UINT32_BE(word1, value1);
+			WRITE_UINT32_BE(word2, value2);
+			WRITE_UINT32_BE(word3, value3);
+		}
+	}
+
+	for (; i < last; ++i)
+		WRITE_UINT32_BE(memory + offsets[i], READ_UINT32_BE(memory + offsets[i]) + delta);
+}
+
+bool RelocationTable::contains(uint32 offset) const {
+	return std::binary_search(_offsets.begin(), _offsets.end(), offset);
+}
+
+namespace RelocationFile {
+
+// All values are stored big endian, like the memory dump itself.
+//
+// Header:
+//   magic, version, base address, dump size, table count
+// Each table:
+//   type, segment id, offset count, offsets
+#define RELOCATION_MAGIC 0x524C4F43 // 'RLOC'
+#define RELOCATION_VERSION 1
+
+void write(const std::string &filename, uint32 base, uint32 dumpSize, const std::vector<RelocationTable> &tables) throw(std::exception) {
+	FILE *file = fopen(filename.c_str(), "wb");
+	if (!file)
+		throw std::runtime_error("Could not open file " + filename + " for writing");
+
+	writeUint32BE(file, RELOCATION_MAGIC);
+	writeUint32BE(file, RELOCATION_VERSION);
+	writeUint32BE(file, base);
+	writeUint32BE(file, dumpSize);
+	writeUint32BE(file, tables.size());
+
+	BOOST_FOREACH(const RelocationTable &table, tables) {
+		writeUint32BE(file, table.getType());
+		writeUint32BE(file, table.getSegmentID());
+		writeUint32BE(file, table.size());
+
+		// Offsets into the dump, independent of the base address
+		BOOST_FOREACH(uint32 offset, table.getOffsets())
+			writeUint32BE(file, offset);
+	}
+
+	const bool failed = ferror(file) != 0;
+	if (fclose(file) != 0 || failed)
+		throw std::runtime_error("Could not write file " + filename);
+}
+
+/**
+ * A file mapped into memory for reading and writing.
+ */
+class MappedFile {
+public:
+	MappedFile(const std::string &filename) throw(std::exception) : _data(0), _size(0) {
+		const int fd = open(filename.c_str(), O_RDWR);
+		if (fd < 0)
+			throw std::runtime_error("Could not open file " + filename);
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size <= 0 || (uint64)st.st_size > 0xFFFFFFFF) {
+			::close(fd);
+			throw std::runtime_error("File " + filename + " has an invalid size");
+		}
+
+		void *mapping = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+
+		if (mapping == MAP_FAILED)
+			throw std::runtime_error("Could not map file " + filename);
+
+		_data = (byte *)mapping;
+		_size = st.st_size;
+	}
+
+	~MappedFile() {
+		munmap(_data, _size);
+	}
+
+	byte *getData() { return _data; }
+	uint32 size() const { return _size; }
+
+private:
+	byte *_data;
+	uint32 _size;
+};
+
+void rebase(const std::string &filename, const std::string &relocationFilename, uint32 base) throw(std::exception) {
+	MappedFile relocationFile(relocationFilename);
+	BigEndianReader src(relocationFile.getData(), relocationFile.size());
+
+	const uint32 magic = src.readUint32();
+	const uint32 version = src.readUint32();
+	const uint32 oldBase = src.readUint32();
+	const uint32 dumpSize = src.readUint32();
+	const uint32 tableCount = src.readUint32();
+
+	if (src.err() || magic != RELOCATION_MAGIC || version != RELOCATION_VERSION)
+		throw std::runtime_error("File " + relocationFilename + " is no relocation file");
+
+	MappedFile dump(filename);
+	if (dump.size() != dumpSize)
+		throw std::runtime_error("Memory dump " + filename + " has size " + boost::lexical_cast<std::string>(dump.size()) + " but the relocation file describes a dump of size " + boost::lexical_cast<std::string>(dumpSize));
+
+	// Decode and validate all tables before touching the dump
+	std::vector<RelocationTable> tables;
+
+	for (uint32 i = 0; i < tableCount; ++i) {
+		const uint32 type = src.readUint32();
+		const uint32 segmentID = src.readUint32();
+		const uint32 count = src.readUint32();
+		const byte *offsets = (!src.err() && count <= src.remaining() / 4) ? src.readSpan(count * 4) : 0;
+
+		if (!offsets || type > RelocationTable::kTypeJumpTable || segmentID > 0xFFFF)
+			throw std::runtime_error("Relocation file " + relocationFilename + " is corrupt");
+
+		tables.push_back(RelocationTable((RelocationTable::Type)type, segmentID));
+
+		BigEndianReader table(offsets, count * 4);
+		if (tables.back().decode(RelocationTable::kEncodingOffsets, table, 0, dumpSize) != RelocationTable::kStatusOK)
+			throw std::runtime_error("Relocation file " + relocationFilename + " contains invalid relocations");
+	}
+
+	if (!src.eos())
+		throw std::runtime_error("Relocation file " + relocationFilename + " is corrupt");
+
+	// Move all base relative words. The new base is recorded first and
+	// restored in case patching fails. A crash in between still leaves the
+	// dump and its relocation file inconsistent, as both are patched in
+	// place.
+	const uint32 delta = base - oldBase;
+
+	WRITE_UINT32_BE(relocationFile.getData() + 8, base);
+
+	try {
+		BOOST_FOREACH(RelocationTable &table, tables)
+			table.apply(dump.getData(), delta);
+	} catch (...) {
+		WRITE_UINT32_BE(relocationFile.getData() + 8, oldBase);
+		throw;
+	}
+}
+
+} // End of namespace RelocationFile
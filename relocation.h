@@ -0,0 +1,287 @@
+/**
+ * Copyright (c) 2011 Johannes Schickel (LordHoto)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ */
+
+#ifndef RELOCATION_H
+#define RELOCATION_H
+
+#include "util.h"
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Forward from bereader.h
+class BigEndianReader;
+
+/**
+ * A decoded relocation table.
+ *
+ * The compressed relocation data is decoded once into a sorted list of
+ * offsets into the memory dump. Each offset addresses a big endian 32bit
+ * word to which the same delta is added.
+ */
+class RelocationTable {
+public:
+	/**
+	 * What the relocated words point to.
+	 */
+	enum Type {
+		/**
+		 * Addresses relative to A5, relocated by a 32bit segment.
+		 */
+		kTypeA5,
+
+		/**
+		 * Addresses inside a 32bit segment.
+		 */
+		kTypeSegment,
+
+		/**
+		 * Addresses relative to A5 inside the %A5Init world.
+		 */
+		kTypeA5World,
+
+		/**
+		 * Function addresses of loaded jump table entries.
+		 */
+		kTypeJumpTable
+	};
+
+	/**
+	 * How the relocation data is compressed.
+	 */
+	enum Encoding {
+		/**
+		 * The format used by 32bit CODE segments.
+		 */
+		kEncodingCode32,
+
+		/**
+		 * The format used by %A5Init segments.
+		 */
+		kEncodingA5World,
+
+		/**
+		 * Plain ascending big endian 32bit offsets, as stored in relocation
+		 * files. The reader has to end with the last offset.
+		 */
+		kEncodingOffsets
+	};
+
+	/**
+	 * The result of decoding relocation data.
+	 */
+	enum Status {
+		kStatusOK,
+
+		/**
+		 * The relocation data ends before its end marker.
+		 */
+		kStatusTruncated,
+
+		/**
+		 * A relocation lies outside of the relocated range, see
+		 * getErrorOffset().
+		 */
+		kStatusOutOfBounds,
+
+		/**
+		 * The relocation data is malformed.
+		 */
+		kStatusInvalid
+	};
+
+	/**
+	 * Create an empty relocation table.
+	 *
+	 * @param type What the relocated words point to.
+	 * @param segmentID The segment the relocation data belongs to.
+	 */
+	RelocationTable(Type type = kTypeSegment, uint16 segmentID = 0);
+
+	/**
+	 * Decode relocation data.
+	 *
+	 * Decoding stops at the first error, the table is empty in that case.
+	 *
+	 * @param encoding How the data is compressed.
+	 * @param src Reader positioned at the relocation data.
+	 * @param base Offset of the relocated range in the memory dump.
+	 * @param size Size of the relocated range, all words must lie inside.
+	 * @return The result.
+	 */
+	Status decode(Encoding encoding, BigEndianReader &src, uint32 base, uint32 size);
+
+	/**
+	 * Use the given offsets into the memory dump.
+	 *
+	 * @param offsets The offsets, which have to be sorted.
+	 */
+	void assign(const std::vector<uint32> &offsets);
+
+	/**
+	 * Add the delta to all relocated words.
+	 *
+	 * Huge tables are split across threads in case it is allowed.
+	 *
+	 * @param memory The memory dump.
+	 * @param delta The delta to add.
+	 * @param threadCount The maximum number of threads to use.
+	 */
+	void apply(byte *memory, uint32 delta, uint threadCount = 1);
+
+	/**
+	 * Query what the relocated words point to.
+	 */
+	Type getType() const { return _type; }
+
+	/**
+	 * Query the segment the relocation data belongs to.
+	 */
+	uint16 getSegmentID() const { return _segmentID; }
+
+	/**
+	 * Query the delta applied last.
+	 */
+	uint32 getDelta() const { return _delta; }
+
+	/**
+	 * Query the sorted offsets of the relocated words in the memory dump.
+	 */
+	const std::vector<uint32> &getOffsets() const { return _offsets; }
+
+	/**
+	 * Query the number of relocations.
+	 */
+	uint32 size() const { return _offsets.size(); }
+
+	/**
+	 * Check whether the word at the given offset is relocated.
+	 */
+	bool contains(uint32 offset) const;
+
+	/**
+	 * Query the offset, relative to the relocated range, of the relocation
+	 * which made decoding fail with kStatusOutOfBounds.
+	 */
+	uint32 getErrorOffset() const { return _errorOffset; }
+
+	/**
+	 * Read a run length as used by the %A5Init data and relocation formats.
+	 *
+	 * @param src Where to read from.
+	 * @param special Special repeat counter.
+	 * @return The decoded run length.
+	 */
+	static uint32 getRunLength(BigEndianReader &src, uint32 &special);
+
+private:
+	/**
+	 * Decode the 32bit CODE segment format.
+	 */
+	Status decodeCode32(BigEndianReader &src, uint32 base, uint32 size);
+
+	/**
+	 * Decode the %A5Init format.
+	 */
+	Status decodeA5World(BigEndianReader &src, uint32 base, uint32 size);
+
+	/**
+	 * Decode plain offsets.
+	 */
+	Status decodeOffsets(BigEndianReader &src, uint32 base, uint32 size);
+
+	/**
+	 * Add a relocation, relative to the relocated range.
+	 *
+	 * @return false in case it lies outside of the range.
+	 */
+	bool add(uint64 offset, uint32 base, uint32 size);
+
+	/**
+	 * Add the delta to a range of the offsets.
+	 */
+	void applyRange(byte *memory, uint32 first, uint32 last) const;
+
+	/**
+	 * What the relocated words point to.
+	 */
+	Type _type;
+
+	/**
+	 * The segment the relocation data belongs to.
+	 */
+	uint16 _segmentID;
+
+	/**
+	 * The delta applied last.
+	 */
+	uint32 _delta;
+
+	/**
+	 * The sorted offsets of the relocated words.
+	 */
+	std::vector<uint32> _offsets;
+
+	/**
+	 * Whether some relocated words overlap, in which case they have to be
+	 * patched one after another.
+	 */
+	bool _overlapping;
+
+	/**
+	 * The offending offset of a failed decode.
+	 */
+	uint32 _errorOffset;
+};
+
+/**
+ * Relocation files describe every word of a memory dump which depends on the
+ * address the dump is loaded at. They allow moving a dump to another base
+ * address without loading the executable again.
+ */
+namespace RelocationFile {
+
+/**
+ * Write a relocation file.
+ *
+ * @param filename The file to write.
+ * @param base The base address the memory dump is loaded at.
+ * @param dumpSize The size of the memory dump.
+ * @param tables The relocation tables describing the base relative words.
+ * @throws std::exception Errors on writing.
+ */
+void write(const std::string &filename, uint32 base, uint32 dumpSize, const std::vector<RelocationTable> &tables) throw(std::exception);
+
+/**
+ * Move a memory dump to a new base address in place.
+ *
+ * Only the dump and its relocation file are accessed, both are mapped into
+ * memory. The relocation file is updated to the new base as well.
+ *
+ * @param filename The memory dump.
+ * @param relocationFilename The relocation file of the memory dump.
+ * @param base The new base address.
+ * @throws std::exception Errors on rebasing, the dump is left untouched.
+ */
+void rebase(const std::string &filename, const std::string &relocationFilename, uint32 base) throw(std::exception);
+
+} // End of namespace RelocationFile
+
+#endif
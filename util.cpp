@@ -19,7 +19,8 @@
 
 #include "util.h"
 
-// Helper functions for reading integers from the stream (maintaining endianness)
+// Helper functions for reading integers from the stream (maintaining endianness).
+// Every value is transferred with a single stdio call.
 byte readByte(FILE *file) {
 	byte b = 0;
 	fread(&b, 1, 1, file);
@@ -27,23 +28,27 @@ byte readByte(FILE *file) {
 }
 
 uint16 readUint16LE(FILE *file) {
-	uint16 x = readByte(file);
-	return x | readByte(file) << 8;
+	byte b[2] = { 0, 0 };
+	fread(b, 1, 2, file);
+	return b[0] | (b[1] << 8);
 }
 
 uint32 readUint32LE(FILE *file) {
-	uint16 x = readUint16LE(file);
-	return x | readUint16LE(file) << 16;
+	byte b[4] = { 0, 0, 0, 0 };
+	fread(b, 1, 4, file);
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32)b[3] << 24);
 }
 
 uint16 readUint16BE(FILE *file) {
-	uint16 x = readByte(file) << 8;
-	return x | readByte(file);
+	byte b[2] = { 0, 0 };
+	fread(b, 1, 2, file);
+	return READ_UINT16_BE(b);
 }
 
 uint32 readUint32BE(FILE *file) {
-	uint32 x = readUint16BE(file) << 16;
-	return x | readUint16BE(file); 
+	byte b[4] = { 0, 0, 0, 0 };
+	fread(b, 1, 4, file);
+	return READ_UINT32_BE(b);
 }
 
 void writeByte(FILE *file, byte b) {
@@ -51,23 +56,25 @@ void writeByte(FILE *file, byte b) {
 }
 
 void writeUint16LE(FILE *file, uint16 x) {
-	writeByte(file, x & 0xff);
-	writeByte(file, x >> 8);
+	byte b[2] = { (byte)(x & 0xff), (byte)(x >> 8) };
+	fwrite(b, 1, 2, file);
 }
 
 void writeUint32LE(FILE *file, uint32 x) {
-	writeUint16LE(file, x & 0xffff);
-	writeUint16LE(file, x >> 16);
+	byte b[4] = { (byte)(x & 0xff), (byte)((x >> 8) & 0xff), (byte)((x >> 16) & 0xff), (byte)(x >> 24) };
+	fwrite(b, 1, 4, file);
 }
 
 void writeUint16BE(FILE *file, uint16 x) {
-	writeByte(file, x >> 8);
-	writeByte(file, x & 0xff);
+	byte b[2];
+	WRITE_UINT16_BE(b, x);
+	fwrite(b, 1, 2, file);
 }
 
 void writeUint32BE(FILE *file, uint32 x) {
-	writeUint16BE(file, x >> 16);
-	writeUint16BE(file, x & 0xffff);
+	byte b[4];
+	WRITE_UINT32_BE(b, x);
+	fwrite(b, 1, 4, file);
 }
 
 uint32 getFileSize(FILE *file) {
@@ -80,22 +87,3 @@ uint32 getFileSize(FILE *file) {
 	fseek(file, pos, SEEK_SET);
 	return size;
 }
-
-uint16 READ_UINT16_BE(const byte *data) {
-	return (*data << 8) | *(data + 1);
-}
-
-uint32 READ_UINT32_BE(const byte *data) {
-	return (READ_UINT16_BE(data) << 16) | READ_UINT16_BE(data + 2);
-}
-
-void WRITE_UINT16_BE(byte *p, uint16 data) {
-	p[0] = data >> 8;
-	p[1] = data & 0xFF;
-}
-
-void WRITE_UINT32_BE(byte *p, uint32 data) {
-	WRITE_UINT16_BE(p, data >> 16);
-	WRITE_UINT16_BE(p + 2, data & 0xFFFF);
-}
-
@@ -31,12 +31,31 @@ typedef int16_t int16;
 typedef uint16_t uint16;
 typedef int32_t int32;
 typedef uint32_t uint32;
+typedef int64_t int64;
+typedef uint64_t uint64;
 typedef unsigned int uint;
 
-uint16 READ_UINT16_BE(const byte *data);
-uint32 READ_UINT32_BE(const byte *data);
-void WRITE_UINT16_BE(byte *p, uint16 data);
-void WRITE_UINT32_BE(byte *p, uint32 data);
+// Kept inline, so an optimizing compiler turns them into a single load or
+// store plus a byte swap
+inline uint16 READ_UINT16_BE(const byte *data) {
+	return (uint16)((data[0] << 8) | data[1]);
+}
+
+inline uint32 READ_UINT32_BE(const byte *data) {
+	return ((uint32)data[0] << 24) | ((uint32)data[1] << 16) | ((uint32)data[2] << 8) | data[3];
+}
+
+inline void WRITE_UINT16_BE(byte *p, uint16 data) {
+	p[0] = data >> 8;
+	p[1] = data & 0xFF;
+}
+
+inline void WRITE_UINT32_BE(byte *p, uint32 data) {
+	p[0] = data >> 24;
+	p[1] = (data >> 16) & 0xFF;
+	p[2] = (data >> 8) & 0xFF;
+	p[3] = data & 0xFF;
+}
 
 byte readByte(FILE *file);
 uint16 readUint16LE(FILE *file);